@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
+#include "chunk_pool.h"
+
+#define CHUNK_POOL_STEPS (1 << CHUNK_POOL_STEP_SHIFT)
+/* class 0 holds the blocks up to 1 << CHUNK_POOL_MIN_SHIFT, then CHUNK_POOL_STEPS classes per power of two */
+#define CHUNK_POOL_CLASSES (1 + (CHUNK_POOL_MAX_SHIFT - CHUNK_POOL_MIN_SHIFT) * CHUNK_POOL_STEPS)
+
+/* idle blocks are chained through their first word */
+struct chunk_pool_block {
+	struct chunk_pool_block * next;
+};
+
+static struct chunk_pool_block * classes[CHUNK_POOL_CLASSES];
+static size_t pool_idle;
+static size_t pool_max_idle = CHUNK_POOL_DEFAULT_IDLE;
+static uint64_t pool_hits;
+static uint64_t pool_misses;
+
+#ifdef THREADS
+// chunks are forged and released on different threads
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define pool_lock() pthread_mutex_lock(&pool_mutex)
+#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
+#else
+#define pool_lock()
+#define pool_unlock()
+#endif
+
+/* returns the class of size and sets *class_size, -1 if size bypasses the pool */
+static int chunk_pool_class_of(const size_t size,size_t * class_size)
+{
+	size_t step;
+	int k, sub;
+
+	if (size <= ((size_t) 1 << CHUNK_POOL_MIN_SHIFT))
+	{
+		*class_size = (size_t) 1 << CHUNK_POOL_MIN_SHIFT;
+		return 0;
+	}
+	if (size > ((size_t) 1 << CHUNK_POOL_MAX_SHIFT))
+		return -1;
+
+	k = CHUNK_POOL_MIN_SHIFT;	/* size is in (2^k, 2^(k+1)] */
+	while (((size_t) 1 << (k + 1)) < size)
+		k++;
+	step = (size_t) 1 << (k - CHUNK_POOL_STEP_SHIFT);
+	sub = (size - ((size_t) 1 << k) + step - 1) / step;	/* 1..CHUNK_POOL_STEPS */
+	*class_size = ((size_t) 1 << k) + sub * step;
+
+	return 1 + (k - CHUNK_POOL_MIN_SHIFT) * CHUNK_POOL_STEPS + sub - 1;
+}
+
+void chunk_pool_destroy(void)
+{
+	struct chunk_pool_block * b;
+	int i;
+
+	for (i = 0; i < CHUNK_POOL_CLASSES; i++)
+		while ((b = classes[i]) != NULL)
+		{
+			classes[i] = b->next;
+			free(b);
+		}
+	pool_idle = 0;
+}
+
+void chunk_pool_init(const size_t max_idle)
+{
+	chunk_pool_destroy();
+	pool_max_idle = max_idle > 0 ? max_idle : CHUNK_POOL_DEFAULT_IDLE;
+	pool_hits = 0;
+	pool_misses = 0;
+}
+
+void * chunk_pool_alloc(const size_t size)
+{
+	struct chunk_pool_block * b;
+	size_t class_size;
+	int k;
+
+	k = chunk_pool_class_of(size,&class_size);
+	if (k < 0)
+	{
+		pool_lock();
+		pool_misses++;
+		pool_unlock();
+		return malloc(size);
+	}
+
+	pool_lock();
+	b = classes[k];
+	if (b)
+	{
+		classes[k] = b->next;
+		pool_idle -= class_size;
+		pool_hits++;
+	}
+	else
+		pool_misses++;
+	pool_unlock();
+
+	return b ? (void *) b : malloc(class_size);
+}
+
+void chunk_pool_free(void * ptr,const size_t size)
+{
+	struct chunk_pool_block * b = ptr;
+	size_t class_size;
+	int k;
+
+	if (ptr == NULL)
+		return;
+
+	k = chunk_pool_class_of(size,&class_size);
+	pool_lock();
+	if (k < 0 || pool_idle + class_size > pool_max_idle)
+	{
+		pool_unlock();
+		free(ptr);
+		return;
+	}
+	b->next = classes[k];
+	classes[k] = b;
+	pool_idle += class_size;
+	pool_unlock();
+}
+
+void chunk_pool_stats(uint64_t * hits,uint64_t * misses)
+{
+	if (hits)
+		*hits = pool_hits;
+	if (misses)
+		*misses = pool_misses;
+}
@@ -0,0 +1,31 @@
+#ifndef __CHUNK_POOL_H__
+#define __CHUNK_POOL_H__ 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHUNK_POOL_MIN_SHIFT 4
+#define CHUNK_POOL_MAX_SHIFT 20
+#define CHUNK_POOL_STEP_SHIFT 3	/* 8 classes per power of two: at most 1/8 rounding waste */
+#define CHUNK_POOL_DEFAULT_IDLE (256 * 1024)
+
+/* size-classed pool of recycled blocks for the chunk structs, reorder buffer
+ * copies and message buffers we allocate and release ourselves. Blocks are
+ * plain malloc()ed, so whatever ends up owned by GRAPES can still be released
+ * with free(), but only blocks coming back through chunk_pool_free() are
+ * reused. Sizes above 1 << CHUNK_POOL_MAX_SHIFT bypass the pool.
+ */
+
+/* max_idle: bytes of idle blocks kept over all classes (0 means default) */
+void chunk_pool_init(const size_t max_idle);
+
+void chunk_pool_destroy(void);
+
+void * chunk_pool_alloc(const size_t size);
+
+/* size must be the one passed to chunk_pool_alloc */
+void chunk_pool_free(void * ptr,const size_t size);
+
+void chunk_pool_stats(uint64_t * hits,uint64_t * misses);
+
+#endif
@@ -82,13 +82,17 @@ void bmap_received(const struct nodeID *fromid, const struct nodeID *ownerid, st
 
 void offer_received(const struct nodeID *fromid, struct chunkID_set *cset, int max_deliver, uint16_t trans_id) {
   struct chunkID_set *cset_acc;
+  bool selective = max_deliver & OFFER_SELECTIVE;
 
   struct peer *from = nodeid_to_peer(fromid, neigh_on_sign_recv);
-  dprintf("The peer %s offers %d chunks, max deliver %d.\n", node_addr_tr(fromid), chunkID_set_size(cset), max_deliver);
+  max_deliver &= ~OFFER_SELECTIVE;
+  dprintf("The peer %s offers %d chunks, max deliver %d%s.\n", node_addr_tr(fromid), chunkID_set_size(cset), max_deliver, selective ? ", selective" : "");
 
   if (from) {
-    //register these chunks in the buffermap. Warning: this should be changed when offers become selective.
-    chunkID_set_clear(from->bmap,0);	//TODO: some better solution might be needed to keep info about chunks we sent in flight.
+    //register these chunks in the buffermap. A selective offer lists only part of it.
+    if (!selective) {
+      chunkID_set_clear(from->bmap,0);	//TODO: some better solution might be needed to keep info about chunks we sent in flight.
+    }
     chunkID_set_union(from->bmap,cset);
     gettimeofday(&from->bmap_timestamp, NULL);
   }
@@ -103,6 +107,12 @@ void offer_received(const struct nodeID *fromid, struct chunkID_set *cset, int m
     chunkID_set_free(cset_acc);
 }
 
+void request_received(const struct nodeID *fromid, struct chunkID_set *cset, int max_deliver, uint16_t trans_id) {
+  dprintf("The peer %s requests %d chunks, max deliver %d.\n", node_addr_tr(fromid), chunkID_set_size(cset), max_deliver);
+
+  send_requested_chunks(fromid, cset, max_deliver, trans_id);
+}
+
 void accept_received(const struct nodeID *fromid, struct chunkID_set *cset, int max_deliver, uint16_t trans_id) {
   struct peer *from = nodeid_to_peer(fromid,0);   //verify that we have really offered, 0 at least garantees that we've known the peer before
 
@@ -154,6 +164,9 @@ int sigParseData(const struct nodeID *fromid, uint8_t *buff, int buff_len) {
           break;
         case sig_accept:
           accept_received(fromid, c_set, chunkID_set_size(c_set), trans_id);
+          break;
+        case sig_request:
+          request_received(fromid, c_set, max_deliver, trans_id);
           break;
 	    case sig_ack:
 	      ack_received(fromid, c_set, chunkID_set_size(c_set), trans_id);
@@ -21,6 +21,13 @@
 #ifndef CHUNK_SIGNALING_H
 #define CHUNK_SIGNALING_H
 
+/*
+ * max_deliver travels in 8 bits: an offer with the top bit set is selective,
+ * listing only chunks the receiver seemed to miss, and is not a buffermap.
+ * Only sent to peers announcing they understand it, see topology.c
+ */
+#define OFFER_SELECTIVE 0x80
+
 int sigParseData(const struct nodeID *from_id, uint8_t *buff, int buff_len);
 
 #endif
\ No newline at end of file
@@ -23,98 +23,223 @@
 #include <string.h>
 #include <stdint.h>
 
-#include "compatibility/timer.h"
-
 #include "chunklock.h"
+#include "loop_clock.h"
 
 #include "net_helper.h"
 
-static struct timeval toutdiff = {2, 0};
-
-
+#define LOCK_TIMEOUT_MS 2000
+#define LOCK_RING_MIN_SIZE 64	// must be a power of 2
+/* hashed timer wheel: WHEEL_SLOTS * WHEEL_TICK_MS must exceed LOCK_TIMEOUT_MS */
+#define WHEEL_TICK_MS 10
+#define WHEEL_SLOTS 256
 
 struct lock {
   int chunkid;
   struct nodeID *peer;
-  struct timeval timestamp;
+  uint64_t deadline;	// in wheel ticks
+  struct lock *wheel_prev, *wheel_next;
 };
 
-struct lock *locks;
-static size_t lsize, lcount=0;
-#define LSIZE_INCREMENT 10
+/*
+ * locks indexed by chunkid modulo ring_size, sized to twice the buffer window:
+ * ids sharing a slot are at least that far apart, the older one gives way
+ */
+static struct lock **ring;
+static size_t ring_size;
+static struct lock *wheel[WHEEL_SLOTS];
+static uint64_t wheel_tick;	// last tick processed
+static struct lock *free_locks;
+static chunk_lock_timeout_cb timeout_cb;
+
+static uint64_t now_tick()
+{
+  return loop_now_us() / 1000 / WHEEL_TICK_MS;
+}
 
-void locks_init()
+static inline size_t ring_slot(int chunkid)
 {
-  if (!locks) {
-    lsize = LSIZE_INCREMENT;
-    locks = malloc(sizeof(struct lock) * lsize);
-    lcount = 0;
+  return (unsigned int)chunkid & (ring_size - 1);
+}
+
+static void locks_init()
+{
+  if (!ring) {
+    chunk_locks_init(0);
   }
+}
 
-  if (lcount == lsize) {
-    lsize += LSIZE_INCREMENT;
-    locks = realloc(locks , sizeof(struct lock) * lsize);
+static void wheel_insert(struct lock *l)
+{
+  struct lock **head = &wheel[l->deadline % WHEEL_SLOTS];
+
+  l->wheel_prev = NULL;
+  l->wheel_next = *head;
+  if (*head) {
+    (*head)->wheel_prev = l;
   }
+  *head = l;
+}
 
-  if (!locks) {
-    fprintf(stderr, "Error allocating memory for locks!\n");
-    exit(EXIT_FAILURE);
+static void wheel_remove(struct lock *l)
+{
+  if (l->wheel_prev) {
+    l->wheel_prev->wheel_next = l->wheel_next;
+  } else {
+    wheel[l->deadline % WHEEL_SLOTS] = l->wheel_next;
+  }
+  if (l->wheel_next) {
+    l->wheel_next->wheel_prev = l->wheel_prev;
   }
 }
 
-int chunk_lock_timed_out(struct lock *l)
+static void lock_release(struct lock *l)
 {
-  struct timeval tnow,tout;
-  gettimeofday(&tnow, NULL);
-  timeradd(&l->timestamp, &toutdiff, &tout);
+  if (l->peer) {
+    nodeid_free(l->peer);
+  }
+  l->wheel_next = free_locks;
+  free_locks = l;
+}
 
-  return timercmp(&tnow, &tout, >);
+static void chunk_lock_remove(struct lock *l)
+{
+  wheel_remove(l);
+  ring[ring_slot(l->chunkid)] = NULL;
+  lock_release(l);
 }
 
-void chunk_lock_remove(struct lock *l){
-  nodeid_free(l->peer);
-  memmove(l, l+1, sizeof(struct lock) * (locks+lcount-l-1));
-  lcount--;
+/*
+ * expire the locks of all the ticks elapsed since the last call.
+ * Expired locks are unlinked first and reported afterwards, so that the
+ * timeout callback may lock chunks again, even the same one.
+ */
+static void chunk_locks_cleanup()
+{
+  uint64_t t, now = now_tick();
+  uint64_t first = wheel_tick + 1;
+  struct lock *expired = NULL;
+
+  if (now - wheel_tick > WHEEL_SLOTS) {	// a full revolution elapsed, visit each slot once
+    first = now - WHEEL_SLOTS;
+  }
+  for (t = first; t < now; t++) {
+    struct lock *l = wheel[t % WHEEL_SLOTS];
+
+    while (l) {
+      struct lock *next = l->wheel_next;
+
+      if (l->deadline < now) {
+        wheel_remove(l);
+        ring[ring_slot(l->chunkid)] = NULL;
+        l->wheel_next = expired;
+        expired = l;
+      }
+      l = next;
+    }
+  }
+  if (now > wheel_tick + 1) {
+    wheel_tick = now - 1;
+  }
+
+  while (expired) {
+    struct lock *l = expired;
+
+    expired = l->wheel_next;
+    if (timeout_cb) {
+      timeout_cb(l->chunkid, l->peer);
+    }
+    lock_release(l);
+  }
 }
 
-void chunk_locks_cleanup(){
-  int i;
+void chunk_locks_init(int window)
+{
+  struct lock *l;
+  size_t size = LOCK_RING_MIN_SIZE;
+
+  while (size < 2 * (size_t) window) {
+    size <<= 1;
+  }
+  if (ring) {	// drop the current locks, they may not fit the new ring
+    size_t i;
 
-  for (i=lcount-1; i>=0; i--) {
-    if (chunk_lock_timed_out(locks+i)) {
-      chunk_lock_remove(locks+i);
+    for (i = 0; i < ring_size; i++) {
+      if (ring[i]) {
+        chunk_lock_remove(ring[i]);
+      }
     }
+    free(ring);
   }
+  while ((l = free_locks)) {
+    free_locks = l->wheel_next;
+    free(l);
+  }
+
+  ring_size = size;
+  ring = calloc(ring_size, sizeof(struct lock *));
+  if (!ring) {
+    fprintf(stderr, "Error allocating memory for locks!\n");
+    exit(EXIT_FAILURE);
+  }
+  wheel_tick = now_tick();
 }
 
-void chunk_lock(int chunkid,struct peer *from){
+int chunk_lock(int chunkid,struct peer *from){
+  struct lock *l;
+
   locks_init();
-  locks[lcount].chunkid = chunkid;
-  locks[lcount].peer = from ? nodeid_dup(from->id) : NULL;
-  gettimeofday(&locks[lcount].timestamp,NULL);
-  lcount++;
+  chunk_locks_cleanup();
+
+  l = ring[ring_slot(chunkid)];
+  if (l) {
+    if (l->chunkid != chunkid && l->chunkid > chunkid) {	// a newer chunk holds the slot
+      return -1;
+    }
+    chunk_lock_remove(l);	// re-lock, or a chunk left far behind
+  }
+
+  if (free_locks) {
+    l = free_locks;
+    free_locks = l->wheel_next;
+  } else {
+    l = malloc(sizeof(struct lock));
+    if (!l) {
+      fprintf(stderr, "Error allocating memory for locks!\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  l->chunkid = chunkid;
+  l->peer = from ? nodeid_dup(from->id) : NULL;
+  l->deadline = now_tick() + LOCK_TIMEOUT_MS / WHEEL_TICK_MS;
+  ring[ring_slot(chunkid)] = l;
+  wheel_insert(l);
+
+  return 0;
 }
 
 void chunk_unlock(int chunkid){
-  int i;
+  struct lock *l;
 
-  for (i=0; i<lcount; i++) {
-    if (locks[i].chunkid == chunkid) {
-      chunk_lock_remove(locks+i);
-      break;
-    }
+  if (!ring) return;
+
+  l = ring[ring_slot(chunkid)];
+  if (l && l->chunkid == chunkid) {
+    chunk_lock_remove(l);
   }
 }
 
 int chunk_islocked(int chunkid){
-  int i;
+  struct lock *l;
+
+  if (!ring) return 0;
 
   chunk_locks_cleanup();
 
-  for (i=0; i<lcount; i++) {
-    if (locks[i].chunkid == chunkid) {
-      return 1;
-    }
-  }
-  return 0;
+  l = ring[ring_slot(chunkid)];
+  return l && l->chunkid == chunkid;
+}
+
+void chunk_lock_set_timeout_cb(chunk_lock_timeout_cb cb){
+  timeout_cb = cb;
 }
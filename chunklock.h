@@ -23,8 +23,18 @@
 
 #include <peer.h>
 
-void chunk_lock(int chunkid,struct peer *from);
+/* window: number of chunk ids a lock may need to be told apart from, e.g. the buffer size */
+void chunk_locks_init(int window);
+
+/* returns -1 if a newer chunk id holds the slot of chunkid */
+int chunk_lock(int chunkid,struct peer *from);
 void chunk_unlock(int chunkid);
 int chunk_islocked(int chunkid);
 
+/* called with the chunk id and owner of every lock expiring unanswered, once
+ * the lock is removed, e.g. to re-request the chunk from someone else: it may
+ * lock chunks again */
+typedef void (*chunk_lock_timeout_cb)(int chunkid, const struct nodeID *owner);
+void chunk_lock_set_timeout_cb(chunk_lock_timeout_cb cb);
+
 #endif //CHUNKLOCK_H
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Loop backend for Linux: the periodic work (offers, chunk pacing, topology
+ * update, neighbourhood logging) is kept in a timer heap and a single
+ * timerfd is armed at the earliest deadline. The timerfd and the chunker
+ * fds sit in an epoll set, whose fd is handed to wait4data as the only user
+ * fd; the loop therefore sleeps until a message, an input or a deadline,
+ * whichever net helper is in use.
+ */
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <net_helper.h>
+#include <chunk.h>
+
+#include "streaming.h"
+#include "topology.h"
+#include "measures.h"
+#include "loop.h"
+#include "loop_clock.h"
+#include "timer_heap.h"
+
+#define FDSSIZE 16
+#define MAX_EVENTS (FDSSIZE + 1)
+#define TIMER_FD_TAG -1
+#define LOG_PERIODS 10		// neighbourhood log every LOG_PERIODS offer periods
+#define WAIT_GUARD_SEC 1	// wait4data timeout, the timerfd normally wakes us first
+
+extern bool neigh_log;
+
+enum loop_timer {
+  TIMER_OFFER,
+  TIMER_CHUNK,
+  TIMER_TOPOLOGY,
+  TIMER_LOG,
+};
+
+static struct timer_heap *timers;
+static int epfd = -1;
+static int tfd = -1;
+static uint64_t armed_at;	// deadline the timerfd is currently armed for, 0 if none
+static uint64_t offer_period;	// base period, for topology update and logging
+static int chunk_copies;
+
+extern struct timeval period;	// offer period, autotuned by ratecontrol.c
+
+static uint64_t offer_interval(void)
+{
+  return period.tv_sec * 1000000ULL + period.tv_usec;
+}
+
+static void timer_add(enum loop_timer t, uint64_t deadline)
+{
+  if (timer_heap_push(timers, deadline, t) < 0) {
+    fprintf(stderr, "Cannot schedule loop timer %d, exiting\n", t);
+    exit(-1);
+  }
+}
+
+static void timer_arm(void)
+{
+  struct itimerspec its;
+  uint64_t deadline;
+
+  if (timer_heap_peek(timers, &deadline) < 0 || deadline == armed_at) {
+    return;
+  }
+  memset(&its, 0, sizeof(its));
+  if (deadline == 0) {	// timerfd reads 0 as "disarm"
+    deadline = 1;
+  }
+  its.it_value.tv_sec = deadline / 1000000;
+  its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+  if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+    perror("timerfd_settime");
+    return;
+  }
+  armed_at = deadline;
+}
+
+static void timer_fire(enum loop_timer t, uint64_t deadline)
+{
+  struct timeval chunk_time_interval = {0, 0};
+
+  switch (t) {
+    case TIMER_OFFER:
+      send_offer();
+      timer_add(t, deadline + offer_interval());
+      break;
+    case TIMER_CHUNK:	// chunkers without fds, e.g., avf
+      spawn_chunk(chunk_copies, &chunk_time_interval);
+      timer_add(t, deadline + chunk_time_interval.tv_sec * 1000000ULL + chunk_time_interval.tv_usec);
+      break;
+    case TIMER_TOPOLOGY:
+      topology_update();
+      timer_add(t, deadline + offer_period);
+      break;
+    case TIMER_LOG:
+      log_neighbourhood();
+#ifndef MONL
+      log_nodes_measures();
+#endif
+      timer_add(t, deadline + LOG_PERIODS * offer_period);
+      break;
+  }
+}
+
+static void timers_run(void)
+{
+  uint64_t now, deadline, expirations;
+  uint64_t due_at[TIMER_LOG + 1];
+  int due[TIMER_LOG + 1];
+  int n, i;
+
+  if (read(tfd, &expirations, sizeof(expirations)) > 0) {
+    armed_at = 0;
+  }
+  // collect first, so that a timer rescheduled at "now" waits for the next round
+  now = loop_now_us();
+  for (n = 0; n <= TIMER_LOG && timer_heap_peek(timers, &deadline) >= 0 && deadline <= now; n++) {
+    due[n] = timer_heap_pop(timers, &due_at[n]);
+  }
+  for (i = 0; i < n; i++) {
+    // do not replay periods we slept through, resume from now
+    timer_fire(due[i], due_at[i] + offer_interval() < now ? now : due_at[i]);
+  }
+}
+
+static void epoll_add(int fd, int tag)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("epoll_ctl");
+    exit(-1);
+  }
+}
+
+static void backend_init(int csize, const int *fds)
+{
+  int i;
+
+  offer_period = csize;
+  usec2timeval(&period, csize);
+  timers = timer_heap_new(4);
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (!timers || epfd < 0 || tfd < 0) {
+    fprintf(stderr, "Cannot initialize the epoll loop, exiting\n");
+    exit(-1);
+  }
+  epoll_add(tfd, TIMER_FD_TAG);
+  for (i = 0; fds && i < FDSSIZE && fds[i] != -1; i++) {
+    epoll_add(fds[i], i);
+  }
+}
+
+static void backend_run(struct nodeID *nodeid, bool source_role)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int wait4fds[2];
+
+  while (true) {
+    struct timeval guard = {WAIT_GUARD_SEC, 0};
+    int data_ready, n, i;
+
+    timer_arm();
+    wait4fds[0] = epfd;
+    wait4fds[1] = -1;
+    data_ready = wait4data(nodeid, &guard, wait4fds);
+    loop_clock_update();
+
+    switch (data_ready) {
+      case 0:
+        break;
+      case 1: //incoming msg
+        handle_msg(nodeid, source_role);
+        break;
+      case 2: //timer or chunker fd ready
+        n = epoll_wait(epfd, events, MAX_EVENTS, 0);
+        for (i = 0; i < n; i++) {
+          if (events[i].data.fd == TIMER_FD_TAG) {
+            timers_run();
+          } else {
+            struct timeval chunk_time_interval;
+
+            spawn_chunk(chunk_copies, &chunk_time_interval);
+          }
+        }
+        break;
+      default:
+        fprintf(stderr,"[ERROR] select on file descriptors returned error: %d\n",data_ready);
+    }
+  }
+}
+
+void source_loop(const char *videofile, struct nodeID *nodeid, int csize, int copies, int buff_size)
+/* source peer loop
+ * @videofile: video input filename
+ * @nodeid: local network identifier
+ * @csize: chunks offer interval in microseconds
+ * @copies: number of copies injected in the overlay
+ * @buff_size: size of the chunk buffer
+ */
+{
+  int fds[FDSSIZE] = {-1};
+  uint64_t now;
+
+  chunk_copies = copies;
+  if (source_init(videofile, nodeid, fds, FDSSIZE, buff_size) < 0) {
+    fprintf(stderr,"Cannot initialize source, exiting");
+    exit(-1);
+  }
+  backend_init(csize, fds);
+
+  now = loop_now_us();
+  timer_add(TIMER_OFFER, now + offer_period);
+  if (fds[0] == -1) {	// no fd to wake us up for new chunks
+    timer_add(TIMER_CHUNK, now);
+  }
+  timer_add(TIMER_TOPOLOGY, now + offer_period);
+  if (neigh_log) {
+    timer_add(TIMER_LOG, now + LOG_PERIODS * offer_period);
+  }
+
+  backend_run(nodeid, true);
+}
+
+void loop(struct nodeID *nodeid, int csize, int buff_size)
+/* generic peer loop
+ * @nodeid: local network identifier
+ * @csize: chunks offer interval in microseconds
+ * @buff_size: size of the chunk buffer
+ */
+{
+  uint64_t now;
+
+  stream_init(buff_size, nodeid);
+  topology_update();
+  backend_init(csize, NULL);
+
+  now = loop_now_us();
+  timer_add(TIMER_OFFER, now + offer_period);
+  timer_add(TIMER_TOPOLOGY, now + offer_period);
+  if (neigh_log) {
+    timer_add(TIMER_LOG, now + LOG_PERIODS * offer_period);
+  }
+
+  backend_run(nodeid, false);
+}
@@ -18,226 +18,615 @@
  * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+/*
+ * Threaded loop, organised as a pipeline:
+ *  - the receive thread blocks on the network and queues raw messages;
+ *  - the forging thread (source only) queues freshly generated chunks;
+ *  - optional decoder threads (peer only) decode chunk messages;
+ *  - the protocol thread is the only one touching the chunk buffer, the
+ *    topology and the signalling state; it never blocks on the network;
+ *  - the send thread performs the actual send_to_peer() calls.
+ * Threads talk through single-producer/single-consumer queues, and every
+ * send_to_peer() issued by the protocol code (ours or GRAPES') is diverted
+ * to the send thread by linking with --wrap=send_to_peer. No lock is held
+ * across network I/O; the only mutexes left guard the wakeup doorbells.
+ */
 #include <sys/time.h>
+#include <sys/select.h>
+#include <time.h>
 #include <unistd.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sched.h>
 #include <pthread.h>
 #include <net_helper.h>
 #include <grapes_msg_types.h>
 #include <peerset.h>
 #include <peer.h>
+#include <chunk.h>
 
 #include "dbg.h"
 #include "chunk_signaling.h"
 #include "streaming.h"
 #include "topology.h"
 #include "loop.h"
+#include "chunk_pool.h"
+#include "loop_clock.h"
 #include "node_addr.h"
+#include "spsc_queue.h"
+#ifdef NH_EXT
+#include "net_helper_ext.h"
+#endif
 
 #define BUFFSIZE 512 * 1024
 #define FDSSIZE 16
+#define RX_QUEUE_SIZE 1024
+#define TX_QUEUE_SIZE 1024
+#define CHUNK_QUEUE_SIZE 64
+#define DECODERS_MAX 8
+
+struct mt_msg {
+  struct nodeID *peer;
+  int len;
+  uint8_t *data;	// right after the struct, or a buffer handed over by the net helper
+  size_t size;	// chunk_pool block size
+};
+
+struct mt_chunk {
+  struct nodeID *peer;
+  int res;	// chunk_decode() result
+  uint16_t transid;
+  struct chunk c;
+};
+
+struct doorbell {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool rung;
+};
+
+struct decoder {
+  struct spsc_queue *in;	// receive -> decoder, raw chunk messages
+  struct spsc_queue *out;	// decoder -> protocol, decoded chunks
+  struct doorbell bell;
+  pthread_t thread;
+};
+
+int __real_send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size);
+
 static int chunks_per_period = 1;
-static int period = 500000;
+static uint64_t base_period = 500000;
+struct timeval period = {0, 500000};	// offer period, autotuned by ratecontrol.c
+static int source_fds[FDSSIZE] = {-1};
 static int done;
-pthread_mutex_t cb_mutex;
-pthread_mutex_t topology_mutex;
+int chunk_decoders = 0;	// threads decoding chunk messages, 0: the protocol thread does it
+static bool source_role;
 static struct nodeID *s;
 
-static void *chunk_forging(void *dummy)
+static struct spsc_queue *rx_queue;	// receive -> protocol
+static struct spsc_queue *chunk_queue;	// forging -> protocol
+static struct spsc_queue *tx_queue;	// protocol -> send
+static struct spsc_queue *sent_queue;	// send -> protocol, sent messages to release
+static struct doorbell protocol_bell;
+static struct doorbell send_bell;
+static pthread_t protocol_thread;
+static __thread bool in_protocol_thread;
+static struct decoder decoders[DECODERS_MAX];
+
+static void doorbell_init(struct doorbell *b)
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  // deadlines are on the loop clock, immune to wall clock steps
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&b->mutex, NULL);
+  pthread_cond_init(&b->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  b->rung = false;
+}
+
+static void doorbell_ring(struct doorbell *b)
+{
+  pthread_mutex_lock(&b->mutex);
+  b->rung = true;
+  pthread_cond_signal(&b->cond);
+  pthread_mutex_unlock(&b->mutex);
+}
+
+// wait until rung or until the monotonic deadline (forever if 0)
+static void doorbell_wait(struct doorbell *b, uint64_t deadline_us)
+{
+  struct timespec ts;
+
+  ts.tv_sec = deadline_us / 1000000;
+  ts.tv_nsec = (deadline_us % 1000000) * 1000;
+  pthread_mutex_lock(&b->mutex);
+  while (!b->rung) {
+    if (!deadline_us) {
+      pthread_cond_wait(&b->cond, &b->mutex);
+    } else if (pthread_cond_timedwait(&b->cond, &b->mutex, &ts) == ETIMEDOUT) {
+      break;
+    }
+  }
+  b->rung = false;
+  pthread_mutex_unlock(&b->mutex);
+}
+
+// next tick of a periodic deadline; if we fell more than a period behind,
+// restart from now instead of firing a burst of late ticks
+static uint64_t deadline_next(uint64_t deadline, uint64_t step, uint64_t now)
+{
+  deadline += step;
+
+  return deadline + step < now ? now : deadline;
+}
+
+static uint64_t monotonic_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// messages are allocated on one thread and released on another: pooled blocks
+static struct mt_msg *msg_new(struct nodeID *peer, const uint8_t *data, int len)
+{
+  struct mt_msg *m;
+
+  m = chunk_pool_alloc(sizeof(struct mt_msg) + len);
+  if (m) {
+    m->peer = peer;
+    m->len = len;
+    m->data = (uint8_t *)(m + 1);
+    m->size = sizeof(struct mt_msg) + len;
+    memcpy(m->data, data, len);
+  }
+
+  return m;
+}
+
+// the peer reference is not released here
+static void msg_free(struct mt_msg *m)
+{
+  if (!m) {
+    return;
+  }
+#ifdef NH_EXT
+  if (m->data != (uint8_t *)(m + 1)) {
+    recv_buffer_free(m->data);
+  }
+#endif
+  chunk_pool_free(m, m->size);
+}
+
+/*
+ * Every send from the protocol thread lands here: the message is copied and
+ * queued for the send thread. A full queue drops the message, like a full
+ * socket buffer would.
+ */
+int __wrap_send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+{
+  struct mt_msg *m;
+
+  if (!in_protocol_thread) {
+    return __real_send_to_peer(from, to, buffer_ptr, buffer_size);
+  }
+  m = msg_new(nodeid_dup(to), buffer_ptr, buffer_size);
+  if (!m) {
+    return -1;
+  }
+  if (spsc_queue_push(tx_queue, m) < 0) {
+    dprintf("Send queue full, dropping message to %s\n", node_addr_tr(to));
+    nodeid_free(m->peer);
+    msg_free(m);
+    return -1;
+  }
+  doorbell_ring(&send_bell);
+
+  return buffer_size;
+}
+
+static void chunk_forged(struct chunk *c)
+{
+  while (spsc_queue_push(chunk_queue, c) < 0 && !done) {
+    sched_yield();
+  }
+  doorbell_ring(&protocol_bell);
+}
+
+// chunkers with fds (e.g. live inputs): forge as soon as input is ready
+static void chunk_forging_fds(void)
+{
+  suseconds_t d;
+  struct chunk *c;
+  fd_set rfds;
+  int i, maxfd;
+
+  while(!done) {
+    struct timeval tout = {1, 0};	// to notice done
+
+    FD_ZERO(&rfds);
+    maxfd = -1;
+    for (i = 0; i < FDSSIZE && source_fds[i] != -1; i++) {
+      FD_SET(source_fds[i], &rfds);
+      maxfd = source_fds[i] > maxfd ? source_fds[i] : maxfd;
+    }
+    if (select(maxfd + 1, &rfds, NULL, NULL, &tout) > 0) {
+      c = generated_chunk(&d);
+      if (c) {
+        chunk_forged(c);
+      }
+    }
+  }
+}
+
+// chunkers without fds tell how long to wait for the next chunk
+static void chunk_forging_timed(void)
 {
   suseconds_t d;
   struct chunk *c;
+  uint64_t next = monotonic_us();
 
   while(!done) {
+    struct timespec ts;
+
+    d = 0;
     c = generated_chunk(&d);
     if (c) {
-      pthread_mutex_lock(&cb_mutex);
-      add_chunk(c);
-      pthread_mutex_unlock(&cb_mutex);
+      chunk_forged(c);
     }
-    usleep(d);	//TODO: handle inputs with fd instead of timer
+    next = deadline_next(next, d > 0 ? d : 0, monotonic_us());
+    ts.tv_sec = next / 1000000;
+    ts.tv_nsec = (next % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+  }
+}
+
+static void *chunk_forging(void *dummy)
+{
+  if (source_fds[0] != -1) {
+    chunk_forging_fds();
+  } else {
+    chunk_forging_timed();
   }
 
   return NULL;
 }
 
-static void *source_receive(void *dummy)
+// hand chunk messages over to the decoders, round robin
+static bool decoder_push(struct mt_msg *m)
 {
-  while (!done) {
-    int len;
-    struct nodeID *remote;
-  static uint8_t buff[BUFFSIZE];
-
-    len = recv_from_peer(s, &remote, buff, BUFFSIZE);
-    if (len < 0) {
-      fprintf(stderr,"Error receiving message. Maybe larger than %d bytes\n", BUFFSIZE);
-      nodeid_free(remote);
-      continue;
-    }
-    switch (buff[0] /* Message Type */) {
-      case MSG_TYPE_TMAN:
-      case MSG_TYPE_STREAMER_TOPOLOGY:
-      case MSG_TYPE_TOPOLOGY:
-        pthread_mutex_lock(&topology_mutex);
-        update_peers(remote, buff, len);
-        pthread_mutex_unlock(&topology_mutex);
-        break;
-      case MSG_TYPE_CHUNK:
-        fprintf(stderr, "Some dumb peer pushed a chunk to me! peer:%s\n",node_addr_tr(remote));
-        break;
-      case MSG_TYPE_SIGNALLING:
-        pthread_mutex_lock(&topology_mutex);
-        sigParseData(remote, buff, len);
-        pthread_mutex_unlock(&topology_mutex);
-        break;
-      default:
-        fprintf(stderr, "Unknown Message Type %x\n", buff[0]);
-    }
+  static int next;
+  struct decoder *d;
+
+  if (!chunk_decoders || source_role || m->data[0] != MSG_TYPE_CHUNK) {
+    return false;
+  }
+  d = &decoders[next++ % chunk_decoders];
+  if (spsc_queue_push(d->in, m) < 0) {
+    return false;
+  }
+  doorbell_ring(&d->bell);
+
+  return true;
+}
+
+#ifdef NH_EXT
+// the net helper hands over its receive buffer, the message just points to it
+static struct mt_msg *msg_recv(void)
+{
+  struct nodeID *remote;
+  struct mt_msg *m;
+  uint8_t *buff;
+  int len;
+
+  len = recv_from_peer_nocopy(s, &remote, &buff);
+  if (len < 0) {
+    fprintf(stderr,"Error receiving message\n");
+    nodeid_free(remote);
+    return NULL;
+  }
+  m = chunk_pool_alloc(sizeof(struct mt_msg));
+  if (!m) {
     nodeid_free(remote);
+    recv_buffer_free(buff);
+    return NULL;
   }
+  m->peer = remote;
+  m->len = len;
+  m->data = buff;
+  m->size = sizeof(struct mt_msg);
 
-  return NULL;
+  return m;
 }
+#else
+static struct mt_msg *msg_recv(void)
+{
+  static uint8_t buff[BUFFSIZE];	// only the receive thread gets here
+  struct nodeID *remote;
+  struct mt_msg *m;
+  int len;
+
+  len = recv_from_peer(s, &remote, buff, BUFFSIZE);
+  if (len < 0) {
+    fprintf(stderr,"Error receiving message. Maybe larger than %d bytes\n", BUFFSIZE);
+    nodeid_free(remote);
+    return NULL;
+  }
+  m = msg_new(remote, buff, len);
+  if (!m) {
+    nodeid_free(remote);
+  }
+
+  return m;
+}
+#endif
 
 static void *receive(void *dummy)
 {
   while (!done) {
-    int len;
-    struct nodeID *remote;
-  static uint8_t buff[BUFFSIZE];
-
-    len = recv_from_peer(s, &remote, buff, BUFFSIZE);
-    if (len < 0) {
-      fprintf(stderr,"Error receiving message. Maybe larger than %d bytes\n", BUFFSIZE);
-      nodeid_free(remote);
+    struct mt_msg *m;
+
+    m = msg_recv();
+    if (!m || decoder_push(m)) {
       continue;
     }
-    dprintf("Received message (%d) from %s\n", buff[0], node_addr_tr(remote));
-    switch (buff[0] /* Message Type */) {
-      case MSG_TYPE_TMAN:
-      case MSG_TYPE_STREAMER_TOPOLOGY:
-      case MSG_TYPE_TOPOLOGY:
-        pthread_mutex_lock(&topology_mutex);
-        update_peers(remote, buff, len);
-        pthread_mutex_unlock(&topology_mutex);
-        break;
-      case MSG_TYPE_CHUNK:
-        dprintf("Chunk message received:\n");
-        pthread_mutex_lock(&cb_mutex);
-        received_chunk(remote, buff, len);
-        pthread_mutex_unlock(&cb_mutex);
-        break;
-      case MSG_TYPE_SIGNALLING:
-        pthread_mutex_lock(&topology_mutex);
-        sigParseData(remote, buff, len);
-        pthread_mutex_unlock(&topology_mutex);
-        break;
-      default:
-        fprintf(stderr, "Unknown Message Type %x\n", buff[0]);
+    if (spsc_queue_push(rx_queue, m) < 0) {
+      dprintf("Receive queue full, dropping message from %s\n", node_addr_tr(m->peer));
+      nodeid_free(m->peer);
+      msg_free(m);
+      continue;
     }
-    nodeid_free(remote);
+    doorbell_ring(&protocol_bell);
   }
 
   return NULL;
 }
 
-static void *topology_sending(void *dummy)
+/*
+ * Decoders copy chunk payloads out of the received messages in parallel;
+ * the decoded chunks go back to the protocol thread, which owns the chunk
+ * buffer, the output and the measures.
+ */
+static void *decoding(void *arg)
 {
-  int gossiping_period = period * 10;
+  struct decoder *d = arg;
+  struct mt_msg *m;
+  struct mt_chunk *mc;
 
-  pthread_mutex_lock(&topology_mutex);
-  update_peers(NULL, NULL, 0);
-  pthread_mutex_unlock(&topology_mutex);
-  while(!done) {
-    pthread_mutex_lock(&topology_mutex);
-    update_peers(NULL, NULL, 0);
-    pthread_mutex_unlock(&topology_mutex);
-    usleep(gossiping_period);
+  while (!done) {
+    doorbell_wait(&d->bell, 0);
+    while ((m = spsc_queue_pop(d->in))) {
+      mc = chunk_pool_alloc(sizeof(struct mt_chunk));
+      if (!mc) {
+        fprintf(stderr, "Memory allocation error!\n");
+        exit(-1);
+      }
+      mc->peer = m->peer;	// released by the protocol thread
+      mc->res = chunk_decode(m->data, m->len, &mc->c, &mc->transid);
+      msg_free(m);
+      while (spsc_queue_push(d->out, mc) < 0) {
+        doorbell_ring(&protocol_bell);
+        sched_yield();
+      }
+      doorbell_ring(&protocol_bell);
+    }
   }
 
   return NULL;
 }
 
-static void *chunk_sending(void *dummy)
+static void decoders_drain(void)
 {
-  int chunk_period = period / chunks_per_period;
+  struct mt_chunk *mc;
+  int i;
 
-  while(!done) {
-    pthread_mutex_lock(&topology_mutex);
-    pthread_mutex_lock(&cb_mutex);
-    send_chunk();
-    pthread_mutex_unlock(&cb_mutex);
-    pthread_mutex_unlock(&topology_mutex);
-    usleep(chunk_period);
+  for (i = 0; i < chunk_decoders; i++) {
+    while ((mc = spsc_queue_pop(decoders[i].out))) {
+      if (mc->res > 0) {
+        chunk_received(mc->peer, &mc->c, mc->transid);
+      } else if (mc->res < 0) {
+        fprintf(stderr,"\tError: can't decode chunk!\n");
+      }
+      nodeid_free(mc->peer);
+      chunk_pool_free(mc, sizeof(struct mt_chunk));
+    }
+  }
+}
+
+static void decoders_start(void)
+{
+  int i;
+
+  if (chunk_decoders > DECODERS_MAX) {
+    chunk_decoders = DECODERS_MAX;
+  }
+  for (i = 0; i < chunk_decoders; i++) {
+    decoders[i].in = spsc_queue_new(RX_QUEUE_SIZE / chunk_decoders);
+    decoders[i].out = spsc_queue_new(RX_QUEUE_SIZE / chunk_decoders);
+    if (!decoders[i].in || !decoders[i].out) {
+      fprintf(stderr, "Cannot allocate the decoder queues, exiting\n");
+      exit(-1);
+    }
+    doorbell_init(&decoders[i].bell);
+    pthread_create(&decoders[i].thread, NULL, decoding, &decoders[i]);
+  }
+}
+
+static void *sending(void *dummy)
+{
+  struct mt_msg *m;
+
+  while (!done) {
+    doorbell_wait(&send_bell, 0);
+    while ((m = spsc_queue_pop(tx_queue))) {
+      __real_send_to_peer(s, m->peer, m->data, m->len);
+      // nodeIDs are refcounted without locks: let their owner release them
+      while (spsc_queue_push(sent_queue, m) < 0) {
+        doorbell_ring(&protocol_bell);
+        sched_yield();
+      }
+    }
+#ifdef NH_EXT
+    send_flush();	// wait4data runs on the receive thread, it does not flush our batch
+#endif
   }
 
   return NULL;
 }
 
-static void *chunk_trading(void *dummy)
+static void dispatch_msg(struct mt_msg *m)
 {
-  int chunk_period = period / chunks_per_period;
+  switch (m->data[0] /* Message Type */) {
+    case MSG_TYPE_TMAN:
+    case MSG_TYPE_NEIGHBOURHOOD:
+    case MSG_TYPE_TOPOLOGY:
+      topology_message_parse(m->peer, m->data, m->len);
+      break;
+    case MSG_TYPE_CHUNK:
+      if (source_role) {
+        fprintf(stderr, "Some dumb peer pushed a chunk to me! peer:%s\n",node_addr_tr(m->peer));
+      } else {
+        received_chunk(m->peer, m->data, m->len);
+      }
+      break;
+    case MSG_TYPE_SIGNALLING:
+      sigParseData(m->peer, m->data, m->len);
+      break;
+    default:
+      fprintf(stderr, "Unknown Message Type %x\n", m->data[0]);
+  }
+}
 
-  while(!done) {
-    pthread_mutex_lock(&topology_mutex);
-    pthread_mutex_lock(&cb_mutex);
-    send_offer();
-    pthread_mutex_unlock(&cb_mutex);
-    pthread_mutex_unlock(&topology_mutex);
-    usleep(chunk_period);
+static void *protocol(void *dummy)
+{
+  uint64_t now, next, next_topology, next_trade;
+  uint64_t gossiping_period = base_period * 10;
+  struct mt_msg *m;
+  struct chunk *c;
+
+  in_protocol_thread = true;
+  loop_clock_update();
+  topology_update();
+  next_topology = next_trade = loop_now_us();
+  while (!done) {
+    loop_clock_update();
+    while ((m = spsc_queue_pop(rx_queue))) {
+      dispatch_msg(m);
+      nodeid_free(m->peer);
+      msg_free(m);
+    }
+    decoders_drain();
+    while ((c = spsc_queue_pop(chunk_queue))) {
+      if (add_chunk(c)) {
+        chunk_pool_free(c, sizeof(struct chunk));
+      }
+    }
+    while ((m = spsc_queue_pop(sent_queue))) {
+      nodeid_free(m->peer);
+      msg_free(m);
+    }
+
+    now = loop_now_us();
+    if (now >= next_topology) {
+      topology_update();
+      next_topology = deadline_next(next_topology, gossiping_period, now);
+    }
+    if (now >= next_trade) {
+      if (source_role) {
+        send_chunk();
+      } else {
+        send_offer();
+      }
+      // re-read every tick: ratecontrol may have retuned the period
+      next_trade = deadline_next(next_trade, (period.tv_sec * 1000000ULL + period.tv_usec) / chunks_per_period, now);
+    }
+
+    next = next_trade < next_topology ? next_trade : next_topology;
+    doorbell_wait(&protocol_bell, next);
   }
 
   return NULL;
 }
 
+static void pipeline_init(void)
+{
+  rx_queue = spsc_queue_new(RX_QUEUE_SIZE);
+  chunk_queue = spsc_queue_new(CHUNK_QUEUE_SIZE);
+  tx_queue = spsc_queue_new(TX_QUEUE_SIZE);
+  sent_queue = spsc_queue_new(TX_QUEUE_SIZE);
+  if (!rx_queue || !chunk_queue || !tx_queue || !sent_queue) {
+    fprintf(stderr, "Cannot allocate the thread queues, exiting\n");
+    exit(-1);
+  }
+  doorbell_init(&protocol_bell);
+  doorbell_init(&send_bell);
+}
+
 void loop(struct nodeID *s1, int csize, int buff_size)
 {
-  pthread_t receive_thread, gossiping_thread, distributing_thread;
-  
-  period = csize;
+  pthread_t receive_thread, sending_thread;
+  int i;
+
+  base_period = csize;
+  period.tv_sec = csize / 1000000;
+  period.tv_usec = csize % 1000000;
   s = s1;
- 
-  peers_init();
+  source_role = false;
+
   stream_init(buff_size, s);
-  pthread_mutex_init(&cb_mutex, NULL);
-  pthread_mutex_init(&topology_mutex, NULL);
-  pthread_create(&receive_thread, NULL, receive, NULL); 
-  pthread_create(&gossiping_thread, NULL, topology_sending, NULL); 
-  pthread_create(&distributing_thread, NULL, chunk_trading, NULL); 
+  pipeline_init();
+  decoders_start();
+  pthread_create(&protocol_thread, NULL, protocol, NULL);
+  pthread_create(&receive_thread, NULL, receive, NULL);
+  pthread_create(&sending_thread, NULL, sending, NULL);
 
+  pthread_join(protocol_thread, NULL);
   pthread_join(receive_thread, NULL);
-  pthread_join(gossiping_thread, NULL);
-  pthread_join(distributing_thread, NULL);
+  pthread_join(sending_thread, NULL);
+  for (i = 0; i < chunk_decoders; i++) {
+    pthread_join(decoders[i].thread, NULL);
+  }
 }
 
 void source_loop(const char *fname, struct nodeID *s1, int csize, int chunks, int buff_size)
 {
-  pthread_t generate_thread, receive_thread, gossiping_thread, distributing_thread;
-  
-  period = csize;
+  pthread_t generate_thread, receive_thread, sending_thread;
+
+  base_period = csize;
+  period.tv_sec = csize / 1000000;
+  period.tv_usec = csize % 1000000;
   chunks_per_period = chunks;
   s = s1;
- 
-  int fds[FDSSIZE];
-  fds[0] = -1;
+  source_role = true;
 
-//  sigInit(s);
-  peers_init();
-  if (source_init(fname, s, fds, FDSSIZE, buff_size) < 0) {
+  if (source_init(fname, s, source_fds, FDSSIZE, buff_size) < 0) {
     fprintf(stderr,"Cannot initialize source, exiting");
     return;
   }
-  pthread_mutex_init(&cb_mutex, NULL);
-  pthread_mutex_init(&topology_mutex, NULL);
-  pthread_create(&receive_thread, NULL, source_receive, NULL); 
-  pthread_create(&gossiping_thread, NULL, topology_sending, NULL); 
-  pthread_create(&distributing_thread, NULL, chunk_sending, NULL); 
-  pthread_create(&generate_thread, NULL, chunk_forging, NULL); 
+  pipeline_init();
+  pthread_create(&protocol_thread, NULL, protocol, NULL);
+  pthread_create(&receive_thread, NULL, receive, NULL);
+  pthread_create(&sending_thread, NULL, sending, NULL);
+  pthread_create(&generate_thread, NULL, chunk_forging, NULL);
 
   pthread_join(generate_thread, NULL);
-  pthread_join(distributing_thread, NULL);
+  pthread_join(protocol_thread, NULL);
   pthread_join(receive_thread, NULL);
-  pthread_join(gossiping_thread, NULL);
+  pthread_join(sending_thread, NULL);
+}
+
+int chunk_test_init(const uint16_t port, const char *ip, int mtu)
+{
+  // chunk test forwarding lives in loop.c and is not wired into the pipeline
+  fprintf(stderr, "Chunk test is not supported by the threaded loop\n");
+
+  return -1;
 }
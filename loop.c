@@ -18,6 +18,9 @@
  * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// sendmmsg
+#endif
 #ifndef _WIN32
 #include <sys/select.h>
 #include <arpa/inet.h>
@@ -39,8 +42,12 @@
 #include <grapes_msg_types.h>
 #include <peerset.h>
 #include <peer.h>
+#include <chunk.h>
 
 #include "compatibility/timer.h"
+#ifdef NH_EXT
+#include "net_helper_ext.h"
+#endif
 
 #include "chunk_signaling.h"
 #include "streaming.h"
@@ -48,6 +55,8 @@
 #include "loop.h"
 #include "dbg.h"
 #include "node_addr.h"
+#include "chunk_pool.h"
+#include "loop_clock.h"
 
 #define BUFFSIZE (512 * 1024)
 #define FDSSIZE 16
@@ -62,12 +71,12 @@ uint32_t chunk_test_seqn = 0;
 
 struct timeval period = {0, 500000};
 
-//calculate timeout based on tnext
+//calculate timeout based on tnext, from the clock cached after the last wait
 void tout_init(struct timeval *tout, const struct timeval *tnext)
 {
   struct timeval tnow;
 
-  gettimeofday(&tnow, NULL);
+  loop_now_tv(&tnow);
   if(timercmp(&tnow, tnext, <)) {
     timersub(tnext, &tnow, tout);
   } else {
@@ -76,88 +85,167 @@ void tout_init(struct timeval *tout, const struct timeval *tnext)
 }
 
 #define min(a, b)   (((a) > (b)) ? (b) : (a))
-void chunk_test_forward(const uint8_t *buff, int len)
-{
+
 #define MON_DATA_HEADER_SPACE 32
 #define MON_PKT_HEADER_SPACE  32
 #define MSG_TYPE_CHUNK        0x11
-  int pkt_len, offset;
-  struct iovec iov[4];
-
-  char h_pkt[MON_PKT_HEADER_SPACE];
-  char h_data[MON_DATA_HEADER_SPACE];
+#define CHUNK_TEST_BATCH      64
 
 #pragma pack(push)
 #pragma pack(1)
-  struct msg_header {
-    uint32_t offset;
-    uint32_t msg_length;
-    int32_t local_con_id;
-    int32_t remote_con_id;
-    int32_t msg_seq_num;
-    uint8_t msg_type;
-    uint8_t len_mon_data_hdr;
-    uint8_t len_mon_packet_hdr;
-  } msg_h;
+struct msg_header {
+  uint32_t offset;
+  uint32_t msg_length;
+  int32_t local_con_id;
+  int32_t remote_con_id;
+  int32_t msg_seq_num;
+  uint8_t msg_type;
+  uint8_t len_mon_data_hdr;
+  uint8_t len_mon_packet_hdr;
+};
 #define MSG_HEADER_SIZE (sizeof(struct msg_header))
 #pragma pack(pop)
 
-  iov[0].iov_base = &msg_h;
-  iov[0].iov_len = MSG_HEADER_SIZE;
+static uint64_t chunk_test_frags;
+static uint64_t chunk_test_calls;
 
-  msg_h.local_con_id = htonl(0);
-  msg_h.remote_con_id = htonl(0);
+#ifndef _WIN32
+// per-fragment state of one batch: the ML header differs by offset only
+static struct msg_header chunk_test_hdr[CHUNK_TEST_BATCH];
+static struct iovec chunk_test_iov[CHUNK_TEST_BATCH][2];
+static struct msghdr chunk_test_msgh[CHUNK_TEST_BATCH];
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+static bool chunk_test_mmsg = true;
+static struct mmsghdr chunk_test_mmsgh[CHUNK_TEST_BATCH];
+#endif
 
-  msg_h.msg_type = MSG_TYPE_CHUNK;
-  msg_h.msg_seq_num = htonl(chunk_test_seqn++);
+static int chunk_test_send(int n)
+{
+  int i, ret, sent = 0;
 
-  iov[1].iov_len = iov[2].iov_len = 0;
-  iov[1].iov_base = h_pkt;
-  iov[2].iov_base = h_data;
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+  while (chunk_test_mmsg && sent < n) {
+    for (i = sent; i < n; i++) {
+      chunk_test_mmsgh[i].msg_hdr = chunk_test_msgh[i];
+      chunk_test_mmsgh[i].msg_len = 0;
+    }
+    ret = sendmmsg(chunk_test_socket, chunk_test_mmsgh + sent, n - sent, 0);
+    chunk_test_calls++;
+    if (ret < 0) {
+      if (errno == ENOSYS) {	// old kernel: fall back to one sendmsg per fragment
+        chunk_test_mmsg = false;
+        break;
+      }
+      return -errno;
+    }
+    sent += ret;
+  }
+#endif
+  for (i = sent; i < n; i++) {
+    ret = sendmsg(chunk_test_socket, &chunk_test_msgh[i], 0);
+    chunk_test_calls++;
+    if (ret < 0) {
+      return -errno;
+    }
+  }
 
-  msg_h.len_mon_data_hdr = iov[2].iov_len;
-  msg_h.len_mon_packet_hdr = iov[1].iov_len;
+  return 0;
+}
+#endif
 
+void chunk_test_forward(const uint8_t *buff, int len)
+{
+#ifndef _WIN32
+  int pkt_len, offset, n, error;
+  uint32_t seqn;
+
+  seqn = htonl(chunk_test_seqn++);
   offset = 0;
+  n = 0;
 
   do {
-    int error, ret;
-    struct msghdr msgh;
-
-    pkt_len = min(chunk_test_mtu - iov[2].iov_len - iov[1].iov_len - iov[0].iov_len, len - offset) ;
-    iov[3].iov_len = pkt_len;
-    iov[3].iov_base = buff + offset;
-
-    msg_h.offset = htonl(offset);
-    msg_h.msg_length = htonl(len);
-
-    msgh.msg_name = &chunk_test_dstudp;
-    msgh.msg_namelen = sizeof(struct sockaddr_storage);
-    msgh.msg_iov = iov;
-    msgh.msg_iovlen = 4;
-    msgh.msg_flags = 0;
-    msgh.msg_control = NULL;
-    msgh.msg_controllen = 0;
-
-    ret = sendmsg(chunk_test_socket, &msgh, 0);
-
-    if (ret  < 0){
-      error = errno;
-      fprintf(stderr, "Chunk test: sendmsg failed errno %d: %s\n", error, strerror(error));
-      break;
-    }
-
+    struct msg_header *h = &chunk_test_hdr[n];
+    struct msghdr *msgh = &chunk_test_msgh[n];
+
+    pkt_len = min(chunk_test_mtu - (int)MSG_HEADER_SIZE, len - offset);
+
+    h->offset = htonl(offset);
+    h->msg_length = htonl(len);
+    h->local_con_id = htonl(0);
+    h->remote_con_id = htonl(0);
+    h->msg_seq_num = seqn;
+    h->msg_type = MSG_TYPE_CHUNK;
+    h->len_mon_data_hdr = 0;
+    h->len_mon_packet_hdr = 0;
+
+    chunk_test_iov[n][0].iov_base = h;
+    chunk_test_iov[n][0].iov_len = MSG_HEADER_SIZE;
+    chunk_test_iov[n][1].iov_base = (uint8_t *)(uintptr_t)(buff + offset);
+    chunk_test_iov[n][1].iov_len = pkt_len;
+
+    msgh->msg_name = &chunk_test_dstudp;
+    msgh->msg_namelen = sizeof(struct sockaddr_in);
+    msgh->msg_iov = chunk_test_iov[n];
+    msgh->msg_iovlen = 2;
+    msgh->msg_flags = 0;
+    msgh->msg_control = NULL;
+    msgh->msg_controllen = 0;
+
+    chunk_test_frags++;
     offset += pkt_len;
+    n++;
+
+    if (n == CHUNK_TEST_BATCH || offset == len) {
+      error = chunk_test_send(n);
+      if (error < 0) {
+        fprintf(stderr, "Chunk test: send failed errno %d: %s\n", -error, strerror(-error));
+        break;
+      }
+      n = 0;
+    }
   } while (offset != len);
+#endif
+}
+
+void chunk_test_stats(uint64_t *frags, uint64_t *syscalls)
+{
+  *frags = chunk_test_frags;
+  *syscalls = chunk_test_calls;
+}
+
+#ifdef NH_EXT
+// the net helper hands over its receive buffer: no copy on the way up
+static int recv_msg(const struct nodeID *nodeid, struct nodeID **remote, uint8_t **buff)
+{
+	return recv_from_peer_nocopy(nodeid, remote, buff);
+}
+
+static void recv_msg_done(uint8_t *buff)
+{
+	recv_buffer_free(buff);
+}
+#else
+static int recv_msg(const struct nodeID *nodeid, struct nodeID **remote, uint8_t **buff)
+{
+	static uint8_t recv_buff[BUFFSIZE];
+
+	*buff = recv_buff;
+	return recv_from_peer(nodeid, remote, recv_buff, BUFFSIZE);
 }
 
+static void recv_msg_done(uint8_t *buff)
+{
+}
+#endif
+
 void handle_msg(const struct nodeID* nodeid,bool source_role)
 {
-	uint8_t buff[BUFFSIZE];
+	uint8_t *buff = NULL;
 	struct nodeID *remote;
 	int len;
 
-	len = recv_from_peer(nodeid, &remote, buff, BUFFSIZE);
+	len = recv_msg(nodeid, &remote, &buff);
 	if (len < 0) {
 		fprintf(stderr,"Error receiving message. Maybe larger than %d bytes\n", BUFFSIZE);
 	}else
@@ -183,6 +271,7 @@ void handle_msg(const struct nodeID* nodeid,bool source_role)
 				fprintf(stderr, "Unknown Message Type %x\n", buff[0]);
 		}
 
+	if (len >= 0) recv_msg_done(buff);
 	nodeid_free(remote);
 }
 
@@ -221,10 +310,11 @@ void spawn_chunk(int chunk_copies,struct timeval *chunk_time_interval)
 	if (new_chunk && add_chunk(new_chunk))
 	{ 
 		inject_chunk(new_chunk,chunk_copies);
-		free(new_chunk); //if add_chunk fails it destroies the chunk
+		chunk_pool_free(new_chunk, sizeof(struct chunk)); //if add_chunk fails it destroies the chunk
 	}
 }
 
+#ifndef LOOP_EPOLL
 void source_loop(const char *videofile, struct nodeID *nodeid, int csize, int chunk_copies, int buff_size)
 /* source peer loop
  * @videofile: video input filename
@@ -235,13 +325,13 @@ void source_loop(const char *videofile, struct nodeID *nodeid, int csize, int ch
  */
 {
 	bool running=true;
-	int data_ready,loop_counter=0;
+	int data_ready,loop_counter=0,nfds;
 	struct timeval awake_epoch, sleep_timer;
 	struct timeval chunk_time_interval, offer_epoch, chunk_epoch, current_epoch; 
   int wait4fds[FDSSIZE],*pfds,fds[FDSSIZE] = {-1};
 
 	usec2timeval(&period,csize);
-	gettimeofday(&awake_epoch,NULL);
+	loop_now_tv(&awake_epoch);
 	timeradd(&awake_epoch,&period,&offer_epoch);
 	chunk_epoch = awake_epoch;
 
@@ -249,20 +339,22 @@ void source_loop(const char *videofile, struct nodeID *nodeid, int csize, int ch
     fprintf(stderr,"Cannot initialize source, exiting");
     exit(-1);
   }
+	for (nfds = 0; nfds < FDSSIZE && fds[nfds] != -1; nfds++);
+	pfds = nfds ? wait4fds : NULL;
 	while(running)
 	{
-		if(fds[0] !=-1) {
-			memmove(wait4fds,fds,sizeof(fds)); // bug in copy size?
-			pfds = wait4fds;
-		} else
-			pfds = NULL;
+		// wait4data marks the fds not ready, restore only the live entries
+		if (pfds) {
+			memcpy(wait4fds, fds, sizeof(int) * (nfds < FDSSIZE ? nfds + 1 : nfds));
+		}
 
   	tout_init(&sleep_timer, &awake_epoch);
 		data_ready = wait4data(nodeid,&sleep_timer,pfds);
+		loop_clock_update();
 
 		switch(data_ready) {
 			case 0: // timeout, no socket has data to pick
-				gettimeofday(&current_epoch,NULL);
+				loop_now_tv(&current_epoch);
 				if(timercmp(&offer_epoch, &current_epoch, <)) // offer time !
 				{
 					send_offer();
@@ -306,7 +398,7 @@ void loop(struct nodeID *nodeid,int csize,int buff_size)
 	int data_ready,loop_counter=0;
 	struct timeval epoch, wait_timer; 
 	usec2timeval(&period,csize);
-	gettimeofday(&epoch,NULL);
+	loop_now_tv(&epoch);
 
  	stream_init(buff_size, nodeid);
   topology_update();
@@ -315,6 +407,7 @@ void loop(struct nodeID *nodeid,int csize,int buff_size)
 	{
     tout_init(&wait_timer, &epoch);
     data_ready = wait4data(nodeid, &wait_timer, NULL);
+    loop_clock_update();
 		if(data_ready == 1)
 			// we have been interrupted for an incoming msg
 			handle_msg(nodeid,false);
@@ -327,6 +420,7 @@ void loop(struct nodeID *nodeid,int csize,int buff_size)
 		loop_update(loop_counter++);	
 	}
 }
+#endif	/* LOOP_EPOLL */
 
 int chunk_test_init(const uint16_t port, const char *ip, int mtu)
 {
@@ -21,9 +21,19 @@
 #ifndef LOOP_H
 #define LOOP_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
 void loop(struct nodeID *s, int period, int buff_size);
 void source_loop(const char *fname, struct nodeID *s, int csize, int chunks, int buff_size);
 
 int chunk_test_init(const uint16_t port, const char *ip, const int mtu);
+void chunk_test_stats(uint64_t *frags, uint64_t *syscalls);
+
+/* shared by the loop backends */
+void handle_msg(const struct nodeID *nodeid, bool source_role);
+void spawn_chunk(int chunk_copies, struct timeval *chunk_time_interval);
+void usec2timeval(struct timeval *t, long usec);
 
 #endif	/* LOOP_H */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "loop_clock.h"
+
+static uint64_t clock_mono_us(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#else
+  struct timeval tnow;
+
+  gettimeofday(&tnow, NULL);
+  return tnow.tv_sec * 1000000ULL + tnow.tv_usec;
+#endif
+}
+
+static uint64_t clock_wall_us(void)
+{
+  struct timeval tnow;
+
+  gettimeofday(&tnow, NULL);
+  return tnow.tv_sec * 1000000ULL + tnow.tv_usec;
+}
+
+// per thread: only the thread running the loop updates, and reads, its own
+static __thread uint64_t mono_us;
+static __thread uint64_t wall_us;
+
+void loop_clock_update(void)
+{
+  mono_us = clock_mono_us();
+  wall_us = clock_wall_us();
+}
+
+uint64_t loop_now_us(void)
+{
+  if (!mono_us) loop_clock_update();
+
+  return mono_us;
+}
+
+uint64_t loop_wallclock_us(void)
+{
+  if (!wall_us) loop_clock_update();
+
+  return wall_us;
+}
+
+void loop_now_tv(struct timeval *tv)
+{
+  uint64_t now = loop_now_us();
+
+  tv->tv_sec = now / 1000000;
+  tv->tv_usec = now % 1000000;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOOP_CLOCK_H
+#define LOOP_CLOCK_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/*
+ * Clock cached once per loop iteration, so that the hot paths do not need
+ * to query the system clock for every message, chunk or peer.
+ * The monotonic clock is for intervals and timeouts; the wall clock only
+ * for comparisons with chunk timestamps, which are set by the source.
+ * Reading before the first update refreshes the cache.
+ * The cache is per thread: in THREADS builds it belongs to the protocol
+ * thread, which is the one running the loop.
+ */
+void loop_clock_update(void);
+
+uint64_t loop_now_us(void);
+void loop_now_tv(struct timeval *tv);
+
+uint64_t loop_wallclock_us(void);
+
+#endif	/* LOOP_CLOCK_H */
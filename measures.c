@@ -36,6 +36,10 @@
 #include "streamer.h"
 #include "node_addr.h"
 #include "list.h"
+#include "nodeid_map.h"
+#include "chunk_pool.h"
+#include "loop_clock.h"
+#include "loop.h"
 
 struct timeval print_tdiff = {3600, 0};
 struct timeval tstartdiff = {60, 0};
@@ -73,11 +77,14 @@ struct measures {
 
   int offers_out;
   int accepts_out;
+  int deadlines_scheduled;
+  int deadlines_missed;
   int offers_in;
   int accepts_in;
 };
 
 static struct list_head node_stats; // list of node statistics
+static struct nodeid_map *node_stats_index; // node statistics by nodeID
 static struct measures m;
 
 void clean_measures()
@@ -111,8 +118,12 @@ void print_measures()
 {
   struct timeval tnow;
   double timespan;
+  uint64_t pool_hits, pool_misses;
+#ifndef THREADS
+  uint64_t test_frags, test_calls;
+#endif
 
-  gettimeofday(&tnow, NULL);
+  loop_now_tv(&tnow);
   timespan = tdiff_sec(&tnow, &print_tstart);
 
   if (m.chunks) print_measure("PlayoutRatio", (double)m.played / m.chunks);
@@ -165,12 +176,21 @@ void print_measures()
     print_measure("AcceptOutRate", (double) m.accepts_out / timespan);
   }
   if (m.offers_out) print_measure("OfferAcceptOutRatio", (double)m.accepts_out / m.offers_out);
+  if (m.deadlines_scheduled + m.deadlines_missed) print_measure("DeadlineMissRate", (double)m.deadlines_missed / (m.deadlines_scheduled + m.deadlines_missed));
 
   if (timerisset(&print_tstart)) {
     print_measure("OfferInRate", (double) m.offers_in / timespan);
     print_measure("AcceptInRate", (double) m.accepts_in / timespan);
   }
   if (m.offers_in) print_measure("OfferAcceptInRatio", (double)m.accepts_in / m.offers_in);
+
+  chunk_pool_stats(&pool_hits, &pool_misses);
+  if (pool_hits + pool_misses) print_measure("ChunkPoolHitRatio", (double)pool_hits / (pool_hits + pool_misses));
+
+#ifndef THREADS
+  chunk_test_stats(&test_frags, &test_calls);
+  if (test_calls) print_measure("ChunkTestFragsPerSyscall", (double)test_frags / test_calls);
+#endif
 }
 
 bool print_every()
@@ -178,7 +198,7 @@ bool print_every()
   static bool startup = true;
   struct timeval tnow;
 
-  gettimeofday(&tnow, NULL);
+  loop_now_tv(&tnow);
   if (startup) {
     if (!timerisset(&tstart)) {
       timeradd(&tnow, &tstartdiff, &tstart);
@@ -218,14 +238,11 @@ void reg_chunk_duplicate()
 */
 void reg_chunk_playout(int id, bool b, uint64_t timestamp)
 {
-  struct timeval tnow;
-
   if (!print_every()) return;
 
   m.played += b ? 1 : 0;
   m.chunks++;
-  gettimeofday(&tnow, NULL);
-  m.sum_reorder_delay += (tnow.tv_usec + tnow.tv_sec * 1000000ULL) - timestamp;
+  m.sum_reorder_delay += loop_wallclock_us() - timestamp;
 }
 
 /*
@@ -244,8 +261,6 @@ void reg_neigh_size(int s)
 */
 void reg_chunk_receive(int id, uint64_t timestamp, int hopcount, bool old, bool dup)
 {
-  struct timeval tnow;
-
   if (!print_every()) return;
 
   if (old) {
@@ -256,8 +271,7 @@ void reg_chunk_receive(int id, uint64_t timestamp, int hopcount, bool old, bool
     } else {
       m.chunks_received_nodup++;
       m.sum_hopcount += hopcount;
-      gettimeofday(&tnow, NULL);
-      m.sum_receive_delay += (tnow.tv_usec + tnow.tv_sec * 1000000ULL) - timestamp;
+      m.sum_receive_delay += loop_wallclock_us() - timestamp;
     }
   }
 }
@@ -272,6 +286,17 @@ void reg_chunk_send(int id)
   m.chunks_sent++;
 }
 
+/*
+ * Register an EDF scheduling decision: sent in time or skipped as too late
+*/
+void reg_deadline_miss(bool missed)
+{
+  if (!print_every()) return;
+
+  if (missed) m.deadlines_missed++;
+  else m.deadlines_scheduled++;
+}
+
 /*
  * Register offer-accept transaction initited by us (accept receive event)
 */
@@ -391,6 +416,11 @@ void reg_period(double period)
 void init_measures()
 {
 	INIT_LIST_HEAD(&node_stats);	
+	node_stats_index = nodeid_map_new(NODEID_MAP_INIT_SIZE);
+	if (!node_stats_index) {
+		fprintf(stderr, "Error allocating memory for node statistics!\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 /*
@@ -403,15 +433,7 @@ void end_measures()
 
 struct node_statistics * get_node_statistics(const struct nodeID * id)
 {
-	struct node_statistics * ns = NULL;
-	struct list_head * ptr;
-	bool found = false;
-	list_for_each_conditioned(ptr,&node_stats,found){
-		ns = list_entry(ptr,struct node_statistics,list);
-		if (nodeid_cmp(ns->node,  id) == 0) 
-			found = true; // to stop the loop
-	}
-	return found?ns:NULL;
+	return nodeid_map_get(node_stats_index, id);
 }
 
 double get_reception_rate_measure(const struct nodeID *id)
@@ -423,6 +445,16 @@ double get_reception_rate_measure(const struct nodeID *id)
 		return 0;
 }
 
+// smoothed offer-accept RTT in seconds, -1 if not measured yet
+double get_offer_accept_rtt_measure(const struct nodeID *id)
+{
+	struct node_statistics * ns = get_node_statistics(id);
+	if(ns)
+		return ns->offer_accept_rtt;
+	else
+		return -1;
+}
+
 /*
  * Initialize p2p measurements towards a peer
 */
@@ -434,6 +466,12 @@ void add_measures(const struct nodeID *id)
 		node_stat->reception_rate = 1-MIN_RATE_VALUE;
 		node_stat->offer_accept_rtt = -1;
 		list_add(&(node_stat->list),&node_stats);
+		if (nodeid_map_insert(node_stats_index, id, node_stat) < 0) {	// not indexed: would be added again
+			fprintf(stderr, "Error allocating memory for node statistics!\n");
+			list_del(&node_stat->list);
+			nodeid_free(node_stat->node);
+			free(node_stat);
+		}
 	}
 }
 
@@ -442,15 +480,13 @@ void add_measures(const struct nodeID *id)
 */
 void delete_measures(const struct nodeID *id)
 {
-	struct list_head * ptr,*swap;
 	struct node_statistics * elem;
-	list_for_each_safe(ptr,swap,&node_stats){
-		elem = list_entry(ptr,struct node_statistics,list);
-		if (nodeid_cmp(elem->node,id)) {
-			list_del(ptr);
-			free(elem->node);
-			free(elem);
-		}
+
+	elem = nodeid_map_remove(node_stats_index, id);
+	if (elem) {
+		list_del(&elem->list);
+		nodeid_free(elem->node);
+		free(elem);
 	}
 }
 
@@ -476,7 +512,7 @@ void reception_measure(const struct nodeID *id)
 	}
 }
 
-void offer_accept_rtt_measure(const struct nodeID *id,const uint64_t oa_rtt)
+void offer_accept_rtt_measure(const struct nodeID *id,const double oa_rtt)
 {
 	struct node_statistics * ns;
 	ns = get_node_statistics(id);
@@ -41,11 +41,12 @@ struct node_statistics {
 	double reception_rate; // ratio of expected msg arrived
 	double offer_accept_rtt;
 };
-void offer_accept_rtt_measure(const struct nodeID *id,const uint64_t oa_rtt);
+void offer_accept_rtt_measure(const struct nodeID *id,const double oa_rtt);
 void reception_measure(const struct nodeID *id);
 void timeout_reception_measure(const struct nodeID *id);
 void log_nodes_measures();
 double get_reception_rate_measure(const struct nodeID *id);
+double get_offer_accept_rtt_measure(const struct nodeID *id);
 #endif
 
 void init_measures();
@@ -63,6 +64,7 @@ void reg_offer_accept_in(bool b);
 void reg_offers_in_flight(int running_offer_threads);
 void reg_queue_delay(double last_queue_delay);
 void reg_period(double period);
+void reg_deadline_miss(bool missed);
 
 double get_receive_delay(void);
 #ifdef MONL
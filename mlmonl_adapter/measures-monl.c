@@ -49,7 +49,7 @@ typedef struct nodeID {
 	int n_mhs;
 } nodeID;
 
-static MonHandler chunk_dup = -1, chunk_playout = -1 , neigh_size = -1, chunk_receive = -1, chunk_send = -1, offer_accept_in = -1, offer_accept_out = -1, chunk_hops = -1, chunk_delay = -1, playout_delay = -1;
+static MonHandler chunk_dup = -1, chunk_playout = -1 , neigh_size = -1, chunk_receive = -1, chunk_send = -1, offer_accept_in = -1, offer_accept_out = -1, deadline_miss = -1, chunk_hops = -1, chunk_delay = -1, playout_delay = -1;
 static MonHandler queue_delay = -1 , offers_in_flight = -1;
 static MonHandler period = -1;
 
@@ -213,6 +213,19 @@ void reg_offer_accept_out(bool b)
 }
 
 
+/*
+ * Register an EDF scheduling decision: sent in time or skipped as too late
+*/
+void reg_deadline_miss(bool missed)
+{
+	if (deadline_miss < 0) {
+		enum stat_types st[] = {WIN_AVG};
+		// ratio of chunks skipped because they could not make their deadline
+		add_measure(&deadline_miss, GENERIC, 0, PEER_PUBLISH_INTERVAL, "DeadlineMiss", st, sizeof(st)/sizeof(enum stat_types), NULL, MSG_TYPE_ANY);	//[no unit -> ratio]
+	}
+	monNewSample(deadline_miss, missed);
+}
+
 /*
  * Register the number of offers in flight at each offer sent event
 */
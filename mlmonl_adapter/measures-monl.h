@@ -41,11 +41,12 @@ struct node_statistics {
 	double reception_rate; // ratio of expected msg arrived
 	double offer_accept_rtt;
 };
-void offer_accept_rtt_measure(const struct nodeID *id,const uint64_t oa_rtt);
+void offer_accept_rtt_measure(const struct nodeID *id,const double oa_rtt);
 void reception_measure(const struct nodeID *id);
 void timeout_reception_measure(const struct nodeID *id);
 void log_nodes_measures();
 double get_reception_rate_measure(const struct nodeID *id);
+double get_offer_accept_rtt_measure(const struct nodeID *id);
 #endif
 
 void init_measures();
@@ -12,6 +12,7 @@
 #endif
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -19,6 +20,7 @@
 #include <signal.h>
 
 #include "net_helper-ml.h"
+#include "../net_helper_ext.h"
 #include "ml.h"
 #include "grapes_config.h"
 
@@ -33,13 +35,31 @@
 #include "napa.h"
 #include "napa_log.h"
 
+#ifdef THREADS
+#include <pthread.h>
+
+// the threaded loop receives, sends and dups/frees nodeIDs on different
+// threads: the lookup table, the refcounts, the pending lists and the send
+// slots are only touched with this held. Recursive, since the ml may call
+// back into us from within mlOpenConnection.
+static pthread_mutex_t nodeid_mutex;
+#define nodeid_lock() pthread_mutex_lock(&nodeid_mutex)
+#define nodeid_unlock() pthread_mutex_unlock(&nodeid_mutex)
+#else
+#define nodeid_lock()
+#define nodeid_unlock()
+#endif
+
 /**
  * libevent pointer
  */
 struct event_base *base;
 
 #define NH_BUFFER_SIZE 1000
-#define NH_LOOKUP_SIZE 1000
+#define NH_SEND_SLOTS_LOW 8	// congested below capacity / NH_SEND_SLOTS_LOW free send slots
+#define NH_PENDING_MAX 32	// msgs waiting for the connection of a single node
+#define NH_LOOKUP_SIZE 1024	// initial number of buckets of the nodeID lookup table
+#define NH_LOOKUP_FREE_MAX 256	// evicted nodeIDs kept around for reuse
 #define NH_PACKET_TIMEOUT {0, 500*1000}
 #define NH_ML_INIT_TIMEOUT {1, 0}
 
@@ -53,9 +73,6 @@ static int stun_servers_cnt = 0;
 
 static bool connect_on_know = false;	//whether to try to connect as soon as we get to know a nodeID
 
-static int sIdx = 0;
-static int rIdxML = 0;	//reveive from ML to this buffer position
-static int rIdxUp = 0;	//hand up to layer above at this buffer position
 
 typedef struct nodeID {
 	socketID_handle addr;
@@ -66,130 +83,318 @@ typedef struct nodeID {
 	MonHandler mhs[20];
 	int n_mhs;
 #endif
+	// fields below are private to the net helper: measures-monl.c mirrors the ones above
+	uint32_t hash;	// hash of addr, used by the lookup table
+	struct nodeID *lookup_next;	// next node in the same lookup bucket (or in the free list)
+	bool conn_opening;	// mlOpenConnection issued, waiting for connReady_cb
+	int pending_head, pending_tail;	// sendingBuffer slots of the msgs waiting for the connection, -1 if none
+	int pending_count;	// msgs in the pending list, at most NH_PENDING_MAX
+	struct event *conn_timer;	// drops the pending msgs if the connection is not up in time
 //	int addrSize;
 //	int addrStringSize;
 } nodeID;
 
 typedef struct msgData_cb {
-	int bIdx;	// index of the message in the proper buffer
 	unsigned char msgType; // message type
 	int mSize;	// message size
-	bool conn_cb_called;
-	bool cancelled;
+	int next;	// slot of the next msg waiting for the same connection, -1 if none
 } msgData_cb;
 
-static struct nodeID **lookup_array;
-static int lookup_max = NH_LOOKUP_SIZE;
-static int lookup_curr = 0;
+static struct nodeID **lookup_table;
+static int lookup_size = NH_LOOKUP_SIZE;
+static int lookup_count = 0;
+static struct nodeID *lookup_free;
+static int lookup_free_count = 0;
 
 static nodeID *me; //TODO: is it possible to get rid of this (notwithstanding ml callback)??
 static int timeoutFired = 0;
 static bool fdTriggered = false;
 
+// wait4data events, registered once and re-armed on every call
+static struct event *timeout_ev;
+static struct event *fd_ev[FDSSIZE];
+static int fd_ev_fd[FDSSIZE];
+static bool fd_triggered[FDSSIZE];
+static int fd_ev_count = 0;
+
 // pointers to the msgs to be send
-static uint8_t *sendingBuffer[NH_BUFFER_SIZE];
+static uint8_t **sendingBuffer;
+static msgData_cb *sendingMsg;	// free slots are linked through next as well
+static int send_slots = NH_BUFFER_SIZE;	// capacity, "send_slots" config tag
+static int send_free_head = -1;
+static int send_free_count = 0;
+static int send_stalled_count = 0;	// slots held by pending lists which reached NH_PENDING_MAX
+// node owning each ML connection we opened, to spot connIDs recycled by the ML
+static struct nodeID **conn_owner;
+static int conn_owner_size = 0;
 // pointers to the received msgs + sender nodeID
 struct receivedB {
 	struct nodeID *id;
 	int len;
 	uint8_t *data;
 };
-static struct receivedB receivedBuffer[NH_BUFFER_SIZE];
+// received msgs are queued per class and handed up in class order, so that
+// a burst of chunks can neither delay nor crowd out the signalling
+enum recv_class {RQ_SIGNALLING, RQ_TOPOLOGY, RQ_CHUNK, RQ_CLASSES};
+static const char *recv_class_tag[RQ_CLASSES] = {"recv_slots_sig", "recv_slots_topo", "recv_slots_chunk"};
+struct recv_queue {
+	struct receivedB *ring;
+	int size;
+	int rIdxML;	//reveive from ML to this buffer position
+	int rIdxUp;	//hand up to layer above at this buffer position
+	int count;
+};
+static struct recv_queue recvQueue[RQ_CLASSES];
+static int recv_pending = 0;	// msgs queued in all the classes
 /**/ static int recv_counter =0;
 
 
 static void connReady_cb (int connectionID, void *arg);
+static int conn_open(struct nodeID *n);
+static void pending_drop(struct nodeID *n);
+static int pending_add(struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size);
 static struct nodeID *new_node(socketID_handle peer) {
-	send_params params = {0,0,0,0};
-	struct nodeID *res = malloc(sizeof(struct nodeID));
-	if (!res) {
-		 fprintf(stderr, "Net-helper : memory error\n");
-		 return NULL;
-	}
-	memset(res, 0, sizeof(struct nodeID));
+	struct nodeID *res;
 
-	res->addr = malloc(SOCKETID_SIZE);
-	if (! res->addr) {
-		free (res);
-		fprintf(stderr, "Net-helper : memory error while creating a new nodeID \n");
-		return NULL;
+	if (lookup_free) {	// reuse an evicted node, together with its addr buffer
+		socketID_handle addr;
+
+		res = lookup_free;
+		lookup_free = res->lookup_next;
+		lookup_free_count--;
+		addr = res->addr;
+		memset(res, 0, sizeof(struct nodeID));
+		res->addr = addr;
+	} else {
+		res = malloc(sizeof(struct nodeID));
+		if (!res) {
+			 fprintf(stderr, "Net-helper : memory error\n");
+			 return NULL;
+		}
+		memset(res, 0, sizeof(struct nodeID));
+
+		res->addr = malloc(SOCKETID_SIZE);
+		if (! res->addr) {
+			free (res);
+			fprintf(stderr, "Net-helper : memory error while creating a new nodeID \n");
+			return NULL;
+		}
 	}
 	memset(res->addr, 0, SOCKETID_SIZE);
 	memcpy(res->addr, peer ,SOCKETID_SIZE);
 
 	res->refcnt = 1;
+	res->connID = -1;
+	res->pending_head = res->pending_tail = -1;
+	res->pending_count = 0;
 
 	if (connect_on_know) {
-		res->connID = mlOpenConnection(peer, &connReady_cb, NULL, params);
+		conn_open(res);
 	}
 
 	return res;
 }
 
+/**
+ * Hash of a socketID.
+ * The string form is hashed instead of the raw SOCKETID_SIZE bytes, since
+ * socketIDs built by the ML may carry uninitialised padding that
+ * mlCompareSocketIDs ignores.
+ */
+static uint32_t socketID_hash(socketID_handle addr) {
+	char str[SOCKETID_STRING_SIZE];
+	uint32_t h = 2166136261U;	// FNV-1a
+	const char *c;
+
+	mlSocketIDToString(addr, str, SOCKETID_STRING_SIZE);
+	for (c = str; *c; c++) {
+		h ^= (uint8_t)*c;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/**
+ * A node is unreferenced when the lookup table holds the only reference to it.
+ */
+static bool node_unreferenced(const struct nodeID *n) {
+#ifdef MONL
+	if (n->n_mhs) return false;
+#endif
+	return n->refcnt <= 1;
+}
+
+static void node_release(struct nodeID *n) {
+	if (n->conn_timer) {
+		event_free(n->conn_timer);
+		n->conn_timer = NULL;
+	}
+	pending_drop(n);
+	if (n->connID >= 0 && n->connID < conn_owner_size && conn_owner[n->connID] == n) {
+		conn_owner[n->connID] = NULL;
+	}
+	if (lookup_free_count < NH_LOOKUP_FREE_MAX) {
+		n->lookup_next = lookup_free;
+		lookup_free = n;
+		lookup_free_count++;
+	} else {
+		free(n->addr);
+		free(n);
+	}
+}
 
-static struct nodeID **id_lookup(socketID_handle target) {
+/**
+ * Drop the nodes nobody references anymore from the lookup table.
+ */
+static void lookup_evict_unreferenced() {
+	struct nodeID **pn, *n;
+	int i;
 
-	int i,here=-1;
-	for (i=0;i<lookup_curr;i++) {
-		if (lookup_array[i] == NULL) {
-			if (here < 0) {
-				here = i;
+	for (i = 0; i < lookup_size; i++) {
+		pn = &lookup_table[i];
+		while ((n = *pn)) {
+			if (node_unreferenced(n)) {
+				*pn = n->lookup_next;
+				lookup_count--;
+				node_release(n);
+			} else {
+				pn = &n->lookup_next;
 			}
-		} else if (!mlCompareSocketIDs(lookup_array[i]->addr,target)) {
-			return &lookup_array[i];
 		}
 	}
+}
+
+static void lookup_grow() {
+	struct nodeID **table, *n, *next;
+	int i, size = lookup_size * 2;
 
-	if (here == -1) {
-		here = lookup_curr++;
+	table = calloc(size, sizeof(struct nodeID *));
+	if (!table) {
+		return;	// keep the current table, with longer chains
 	}
+	for (i = 0; i < lookup_size; i++) {
+		for (n = lookup_table[i]; n; n = next) {
+			next = n->lookup_next;
+			n->lookup_next = table[n->hash % size];
+			table[n->hash % size] = n;
+		}
+	}
+	free(lookup_table);
+	lookup_table = table;
+	lookup_size = size;
+}
 
-	if (lookup_curr > lookup_max) {
-		lookup_max *= 2;
-		lookup_array = realloc(lookup_array,lookup_max*sizeof(struct nodeID*));
+/**
+ * Make room for a new node: evict unreferenced nodes first, and grow the
+ * table only if it is still too loaded afterwards.
+ */
+static void lookup_make_room() {
+	if (lookup_count < lookup_size) return;
+
+	lookup_evict_unreferenced();
+	if (lookup_count >= lookup_size * 3 / 4) {
+		lookup_grow();
 	}
+}
+
+static struct nodeID *id_lookup(socketID_handle target) {
+	uint32_t h = socketID_hash(target);
+	struct nodeID *n;
 
-	lookup_array[here] = new_node(target);
-	return &lookup_array[here];
+	for (n = lookup_table[h % lookup_size]; n; n = n->lookup_next) {
+		if (n->hash == h && !mlCompareSocketIDs(n->addr,target)) {
+			return n;
+		}
+	}
+
+	lookup_make_room();
+
+	n = new_node(target);
+	if (!n) {
+		return NULL;
+	}
+	n->hash = h;
+	n->lookup_next = lookup_table[h % lookup_size];
+	lookup_table[h % lookup_size] = n;
+	lookup_count++;
+
+	return n;
 }
 
 static struct nodeID *id_lookup_dup(socketID_handle target) {
-	return nodeid_dup(*id_lookup(target));
+	struct nodeID *n;
+
+	nodeid_lock();
+	n = id_lookup(target);
+	if (n) nodeid_dup(n);
+	nodeid_unlock();
+
+	return n;
 }
 
 
+static enum recv_class recv_classify(unsigned char msgtype) {
+	switch (msgtype) {
+	case MSG_TYPE_SIGNALLING:
+		return RQ_SIGNALLING;
+	case MSG_TYPE_CHUNK:
+		return RQ_CHUNK;
+	default:
+		return RQ_TOPOLOGY;
+	}
+}
+
 /**
- * Look for a free slot in the received buffer and allocates it for immediate use
- * @return the index of a free slot in the received msgs buffer, -1 if no free slot available.
+ * Look for a free slot in the received buffer of a class and allocates it for immediate use
+ * @return the free slot, NULL if the class is full.
  */
-static int next_R() {
-	if (receivedBuffer[rIdxML].data==NULL) {
-		int ret = rIdxML;
-		rIdxML = (rIdxML+1)%NH_BUFFER_SIZE;
-		return ret;
-	} else {
-		//TODO: handle receive overload situation!
-		return -1;
+static struct receivedB *next_R(enum recv_class c) {
+	struct recv_queue *q = &recvQueue[c];
+	struct receivedB *ret;
+
+	if (q->count == q->size) {
+		return NULL;
 	}
+	ret = &q->ring[q->rIdxML];
+	q->rIdxML = (q->rIdxML+1)%q->size;
+	q->count++;
+	recv_pending++;
+	return ret;
 }
 
 /**
- * Look for a free slot in the sending buffer and allocates it for immediate use
+ * Take the next msg to hand up, from the highest priority class having one
+ */
+static struct receivedB *next_Up() {
+	int c;
+
+	for (c = 0; c < RQ_CLASSES; c++) {
+		struct recv_queue *q = &recvQueue[c];
+
+		if (q->count) {
+			struct receivedB *ret = &q->ring[q->rIdxUp];
+
+			q->rIdxUp = (q->rIdxUp+1)%q->size;
+			q->count--;
+			recv_pending--;
+			return ret;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Take a free slot of the sending buffer for immediate use
  * @return the index of a free slot in the sending msgs buffer, -1 if no free slot available.
  */
 static int next_S() {
-	if (sendingBuffer[sIdx]) {
-		int count;
-		for (count=0;count<NH_BUFFER_SIZE;count++) {
-			sIdx = (sIdx+1)%NH_BUFFER_SIZE;
-			if (sendingBuffer[sIdx]==NULL)
-				break;
-		}
-		if (count==NH_BUFFER_SIZE) {
-			return -1;
-		}
+	int i = send_free_head;
+
+	if (i >= 0) {
+		send_free_head = sendingMsg[i].next;
+		send_free_count--;
 	}
-	return sIdx;
+	return i;
 }
 
 
@@ -289,6 +494,30 @@ static void fd_cb (int fd, short flag, void* arg)
   *((bool*)arg) = true;
 }
 
+static void conn_owner_set(int connectionID, struct nodeID *n) {
+	if (connectionID < 0) return;
+	if (connectionID >= conn_owner_size) {
+		struct nodeID **co;
+		int size = conn_owner_size ? conn_owner_size : 64;
+
+		while (size <= connectionID) size *= 2;
+		co = realloc(conn_owner, size * sizeof(struct nodeID *));
+		if (!co) return;
+		memset(co + conn_owner_size, 0, (size - conn_owner_size) * sizeof(struct nodeID *));
+		conn_owner = co;
+		conn_owner_size = size;
+	}
+	conn_owner[connectionID] = n;
+}
+
+/**
+ * Whether the connection cached in the node can be used right away
+ */
+static bool conn_ready(const struct nodeID *n) {
+	return n->connID >= 0 && n->connID < conn_owner_size && conn_owner[n->connID] == n &&
+	       mlGetConnectionStatus(n->connID) == 1;
+}
+
 /**
  * Callback called by ml when a remote node ask for a connection
  * @param connectionID
@@ -296,13 +525,81 @@ static void fd_cb (int fd, short flag, void* arg)
  */
 static void receive_conn_cb(int connectionID, void *arg) {
 //    fprintf(stderr, "Net-helper : remote peer opened the connection %d with arg = %d\n", connectionID,(int)arg);
-
+	// the ML might have recycled the ID of one of our connections
+	nodeid_lock();
+	if (connectionID < conn_owner_size) conn_owner[connectionID] = NULL;
+	nodeid_unlock();
 }
 
 void free_sending_buffer(int i)
 {
 	free(sendingBuffer[i]);
 	sendingBuffer[i] = NULL;
+	sendingMsg[i].next = send_free_head;
+	send_free_head = i;
+	send_free_count++;
+}
+
+// msgs go to the ml right away, or wait for their connection: nothing to flush
+void send_flush(void)
+{
+}
+
+/**
+ * Whether the free send slots are running out. The slots held by a node
+ * whose pending list is full are not counted: that node can't queue more,
+ * so they don't keep the msgs for the other nodes from going out.
+ */
+bool send_congested(void)
+{
+	bool res;
+
+	nodeid_lock();
+	res = send_free_count + send_stalled_count < send_slots / NH_SEND_SLOTS_LOW + 1;
+	nodeid_unlock();
+
+	return res;
+}
+
+static void pending_reset(struct nodeID *n) {
+	if (n->pending_count >= NH_PENDING_MAX) send_stalled_count -= n->pending_count;
+	n->pending_count = 0;
+	n->pending_tail = -1;
+}
+
+static void pending_drop(struct nodeID *n) {
+	while (n->pending_head >= 0) {
+		int i = n->pending_head;
+
+		n->pending_head = sendingMsg[i].next;
+		free_sending_buffer(i);
+	}
+	pending_reset(n);
+}
+
+static void pending_flush(struct nodeID *n) {
+	while (n->pending_head >= 0) {
+		int i = n->pending_head;
+
+		n->pending_head = sendingMsg[i].next;
+		mlSendData(n->connID,(char *)(sendingBuffer[i]),sendingMsg[i].mSize,sendingMsg[i].msgType,NULL);
+		free_sending_buffer(i);
+	}
+	pending_reset(n);
+}
+
+/**
+ * Timeout callback of a connection being opened: give up on its pending msgs
+ */
+static void conn_timeout_cb(int fd, short event, void *arg) {
+	struct nodeID *n = (struct nodeID *)arg;
+
+	nodeid_lock();
+	if (n->conn_opening) {
+		n->conn_opening = false;
+		pending_drop(n);
+	}
+	nodeid_unlock();
 }
 
 /**
@@ -311,19 +608,19 @@ void free_sending_buffer(int i)
  * @param arg
  */
 static void connReady_cb (int connectionID, void *arg) {
-
-	msgData_cb *p;
-	p = (msgData_cb *)arg;
-	if (p == NULL) return;
-	if (p->cancelled) {
-	    free(p);
-	    return;
-	}
-	mlSendData(connectionID,(char *)(sendingBuffer[p->bIdx]),p->mSize,p->msgType,NULL);
-	free_sending_buffer(p->bIdx);
-//	fprintf(stderr,"Net-helper: Message # %d for connection %d sent!\n ", p->bIdx,connectionID);
+	struct nodeID *n = (struct nodeID *)arg;
+
+	if (n == NULL) return;
+	nodeid_lock();
+	conn_owner_set(connectionID, n);
+	n->connID = connectionID;
+	n->conn_opening = false;
+	if (n->conn_timer) event_del(n->conn_timer);
+	pending_flush(n);
+//	fprintf(stderr,"Net-helper: msgs for connection %d sent!\n ", connectionID);
 	//	event_base_loopbreak(base);
-	p->conn_cb_called = true;
+	nodeid_free(n);	// reference taken by conn_open
+	nodeid_unlock();
 }
 
 /**
@@ -332,20 +629,50 @@ static void connReady_cb (int connectionID, void *arg) {
  * @param arg
  */
 static void connError_cb (int connectionID, void *arg) {
-	// simply get rid of the msg in the buffer....
-	msgData_cb *p;
-	p = (msgData_cb *)arg;
-	if (p != NULL) {
-		fprintf(stderr,"Net-helper: Connection %d could not be established to send msg %d.\n ", connectionID,p->bIdx);
-		if (p->cancelled) {
-			free(p);//p->mSize = -1;
-		} else {
-			p->conn_cb_called = true;
-		}
+	// simply get rid of the msgs waiting for it....
+	struct nodeID *n = (struct nodeID *)arg;
+
+	if (n != NULL) {
+		fprintf(stderr,"Net-helper: Connection %d could not be established to send msgs.\n ", connectionID);
+		nodeid_lock();
+		n->conn_opening = false;
+		if (n->conn_timer) event_del(n->conn_timer);
+		pending_drop(n);
+		nodeid_free(n);	// reference taken by conn_open
+		nodeid_unlock();
 	}
 	//	event_base_loopbreak(base);
 }
 
+/**
+ * Ask the ml for a connection to the node, unless one is already being opened.
+ * The pending msgs of the node are sent from connReady_cb.
+ * @return 0 on success, -1 if the ml refused to open the connection
+ */
+static int conn_open(struct nodeID *n) {
+	send_params params = {0,0,0,0};
+	struct timeval timeout = NH_PACKET_TIMEOUT;
+	int connID;
+
+	if (n->conn_opening) return 0;
+
+	n->conn_opening = true;
+	nodeid_dup(n);	// the ml holds the node as callback argument
+	connID = mlOpenConnection(n->addr, &connReady_cb, n, params);
+	if (connID < 0) {
+		n->conn_opening = false;
+		nodeid_free(n);
+		return -1;
+	}
+	n->connID = connID;
+	if (n->conn_opening) {	// not called back yet
+		if (!n->conn_timer) n->conn_timer = evtimer_new(base, &conn_timeout_cb, n);
+		if (n->conn_timer) event_add(n->conn_timer, &timeout);
+	}
+
+	return 0;
+}
+
 
 /**
  * Callback to receive data from ml
@@ -371,21 +698,26 @@ static void recv_data_cb(char *buffer, int buflen, unsigned char msgtype, recv_p
 	else {
 	//	fprintf(stderr, "Net-helper : message arrived from %s\n",str);
 		// buffering the received message only if possible, otherwise ignore it...
-		int index = next_R();
-		if (index<0) {
-			fprintf(stderr,"Net-helper: receive buffer full\n ");
+		uint8_t *data;
+		enum recv_class c = recv_classify(msgtype);
+		struct receivedB *rb;
+
+		data = malloc(buflen);
+		if (data == NULL) {
+			fprintf(stderr,"Net-helper: memory full, can't receive!\n ");
+			return;
+		}
+		rb = next_R(c);
+		if (rb == NULL) {
+			fprintf(stderr,"Net-helper: receive buffer full (%s)\n ", recv_class_tag[c]);
+			free(data);
 			return;
-		} else {
-			receivedBuffer[index].data = malloc(buflen);
-			if (receivedBuffer[index].data == NULL) {
-				fprintf(stderr,"Net-helper: memory full, can't receive!\n ");
-				return;
-			}
-			receivedBuffer[index].len = buflen;
-			memcpy(receivedBuffer[index].data,buffer,buflen);
-			  // save the socketID of the sender
-			receivedBuffer[index].id = id_lookup_dup(arg->remote_socketID);
 		}
+		rb->data = data;
+		rb->len = buflen;
+		memcpy(rb->data,buffer,buflen);
+		  // save the socketID of the sender
+		rb->id = id_lookup_dup(arg->remote_socketID);
   }
 //	event_base_loopbreak(base);
 }
@@ -410,12 +742,20 @@ struct nodeID *net_helper_init(const char *IPaddr, int port, const char *config)
 	int queuesize = 1000000; /* up to 1MB of data will be stored in the shaper transmission queue [Bytes]*/
 	int RTXqueuesize = 1000000; /* up to 1 MB of data will be stored in the shaper retransmission queue [Bytes] */
 	double RTXholtdingtime = 1.0; /* [seconds] */
+#ifdef THREADS
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&nodeid_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
 
 #ifndef _WIN32
 	signal(SIGPIPE, SIG_IGN); // workaround for a known issue in libevent2 with SIGPIPE on TPC connections
 #endif
 	base = event_base_new();
-	lookup_array = calloc(lookup_max,sizeof(struct nodeID *));
+	lookup_table = calloc(lookup_size,sizeof(struct nodeID *));
 
 	cfg_tags = grapes_config_parse(config);
 	if (!cfg_tags) {
@@ -438,6 +778,13 @@ struct nodeID *net_helper_init(const char *IPaddr, int port, const char *config)
 	grapes_config_value_int(cfg_tags, "queuesize", &queuesize);
 	grapes_config_value_int(cfg_tags, "RTXqueuesize", &RTXqueuesize);
 	grapes_config_value_double(cfg_tags, "RTXholtdingtime", &RTXholtdingtime);
+	grapes_config_value_int(cfg_tags, "send_slots", &send_slots);
+	if (send_slots <= 0) send_slots = NH_BUFFER_SIZE;
+	for (i = 0; i < RQ_CLASSES; i++) {
+		recvQueue[i].size = NH_BUFFER_SIZE;
+		grapes_config_value_int(cfg_tags, recv_class_tag[i], &recvQueue[i].size);
+		if (recvQueue[i].size <= 0) recvQueue[i].size = NH_BUFFER_SIZE;
+	}
 
 	me = malloc(sizeof(nodeID));
 	if (me == NULL) {
@@ -446,10 +793,27 @@ struct nodeID *net_helper_init(const char *IPaddr, int port, const char *config)
 	memset(me,0,sizeof(nodeID));
 	me->connID = -10;	// dirty trick to spot later if the ml has called back ...
 	me->refcnt = 1;
+	me->pending_head = me->pending_tail = -1;
+	me->pending_count = 0;
 
-	for (i=0;i<NH_BUFFER_SIZE;i++) {
-		sendingBuffer[i] = NULL;
-		receivedBuffer[i].data = NULL;
+	sendingBuffer = calloc(send_slots, sizeof(uint8_t *));
+	sendingMsg = malloc(send_slots * sizeof(msgData_cb));
+	if (!sendingBuffer || !sendingMsg) {
+		fprintf(stderr, "Net-helper init : can't allocate %d send slots\n", send_slots);
+		return NULL;
+	}
+	for (i = send_slots - 1; i >= 0; i--) {
+		sendingMsg[i].next = send_free_head;
+		send_free_head = i;
+	}
+	send_free_count = send_slots;
+
+	for (i = 0; i < RQ_CLASSES; i++) {
+		recvQueue[i].ring = calloc(recvQueue[i].size, sizeof(struct receivedB));
+		if (!recvQueue[i].ring) {
+			fprintf(stderr, "Net-helper init : can't allocate %d receive slots\n", recvQueue[i].size);
+			return NULL;
+		}
 	}
 
 	mlRegisterErrorConnectionCb(&connError_cb);
@@ -524,21 +888,10 @@ void bind_msg_type (unsigned char msgtype) {
 }
 
 
-void send_to_peer_cb(int fd, short event, void *arg)
-{
-	msgData_cb *p = (msgData_cb *) arg;
-	if (p->conn_cb_called) {
-		free(p);
-	}
-	else { //don't send it anymore
-		free_sending_buffer(p->bIdx);
-		p->cancelled = true;
-		// don't free p, the other timeout will do it
-	}
-}
-
 /**
- * Called by the application to send data to a remote peer
+ * Called by the application to send data to a remote peer.
+ * The msg is handed to the ml right away if the connection to the peer is up,
+ * otherwise it is copied and queued until the connection gets ready.
  * @param from
  * @param to
  * @param buffer_ptr
@@ -547,16 +900,41 @@ void send_to_peer_cb(int fd, short event, void *arg)
  */
 int send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
 {
-	msgData_cb *p;
-	int current, index;
-	send_params params = {0,0,0,0};
+	int connID = -1;
 
 	if (buffer_size <= 0) {
 		fprintf(stderr,"Net-helper: message size problematic: %d\n", buffer_size);
 		return buffer_size;
 	}
 
-	// if buffer is full, discard the message and return an error flag
+	nodeid_lock();
+	if (conn_ready(to)) {
+		connID = to->connID;
+	} else {
+		buffer_size = pending_add(to, buffer_ptr, buffer_size);
+	}
+	nodeid_unlock();
+	if (connID >= 0) {
+		// mlSendData does not modify the buffer
+		mlSendData(connID, (char *)(uintptr_t)buffer_ptr, buffer_size, (unsigned char)buffer_ptr[0], NULL);
+	}
+
+	return buffer_size; //p->mSize;
+}
+
+/**
+ * Copy the msg in a send slot, queued until the connection to the node gets ready.
+ * @return buffer_size, or -1 if the msg had to be dropped
+ */
+static int pending_add(struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+{
+	int index;
+
+	// if the node or the buffer is full, discard the message and return an error flag
+	if (to->pending_count >= NH_PENDING_MAX) {
+		fprintf(stderr,"Net-helper: too many msgs waiting for the connection\n ");
+		return -1;
+	}
 	index = next_S();
 	if (index<0) {
 		// free(buffer_ptr);
@@ -568,28 +946,63 @@ int send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *bu
 		fprintf(stderr,"Net-helper: memory full, can't send!\n ");
 		return -1;
 	}
-	memset(sendingBuffer[index],0,buffer_size);
 	memcpy(sendingBuffer[index],buffer_ptr,buffer_size);
-	// free(buffer_ptr);
-	p = malloc(sizeof(msgData_cb));
-	p->bIdx = index; p->mSize = buffer_size; p->msgType = (unsigned char)buffer_ptr[0]; p->conn_cb_called = false; p->cancelled = false;
-	current = p->bIdx;
-
-	to->connID = mlOpenConnection(to->addr,&connReady_cb,p, params);
-	if (to->connID<0) {
-		free_sending_buffer(current);
-		fprintf(stderr,"Net-helper: Couldn't get a connection ID to send msg %d.\n ", p->bIdx);
-		free(p);
+	sendingMsg[index].mSize = buffer_size;
+	sendingMsg[index].msgType = (unsigned char)buffer_ptr[0];
+	sendingMsg[index].next = -1;
+	if (to->pending_tail >= 0) {
+		sendingMsg[to->pending_tail].next = index;
+	} else {
+		to->pending_head = index;
+	}
+	to->pending_tail = index;
+	if (++to->pending_count == NH_PENDING_MAX) send_stalled_count += NH_PENDING_MAX;
+
+	if (conn_open(to) < 0) {
+		pending_drop(to);
+		fprintf(stderr,"Net-helper: Couldn't get a connection ID to send msg %d.\n ", index);
 		return -1;
 	}
-	else {
-		struct timeval timeout = NH_PACKET_TIMEOUT;
-		event_base_once(base, -1, EV_TIMEOUT, send_to_peer_cb, (void *) p, &timeout);
-		return buffer_size; //p->mSize;
+
+	return buffer_size;
+}
+
+
+/**
+ * Called by an application to receive data from remote peers, taking over the received buffer
+ * @param local
+ * @param remote
+ * @param buffer_ptr
+ * @return The number of received bytes or -1 if some error occurred.
+ */
+int recv_from_peer_nocopy(const struct nodeID *local, struct nodeID **remote, uint8_t **buffer_ptr)
+{
+	int size;
+	struct receivedB *rb;
+
+	if (!recv_pending) {	//block till first message arrives
+		wait4data(local, NULL, NULL);
 	}
 
+	rb = next_Up();
+	assert(rb && rb->data && rb->id);
+
+	(*remote) = rb->id;
+	// hand over the msg buffer
+	size = rb->len;
+	(*buffer_ptr) = rb->data;
+	rb->data = NULL;
+	rb->id = NULL;
+
+//	fprintf(stderr, "Net-helper : I've got mail!!!\n");
+
+	return size;
 }
 
+void recv_buffer_free(uint8_t *buffer_ptr)
+{
+	free(buffer_ptr);
+}
 
 /**
  * Called by an application to receive data from remote peers
@@ -602,71 +1015,72 @@ int send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *bu
 int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size)
 {
 	int size;
-	if (receivedBuffer[rIdxUp].data==NULL) {	//block till first message arrives
-		wait4data(local, NULL, NULL);
-	}
-
-	assert(receivedBuffer[rIdxUp].data && receivedBuffer[rIdxUp].id);
+	uint8_t *data;
 
-	(*remote) = receivedBuffer[rIdxUp].id;
-	// retrieve a msg from the buffer
-	size = receivedBuffer[rIdxUp].len;
+	size = recv_from_peer_nocopy(local, remote, &data);
 	if (size>buffer_size) {
 		fprintf(stderr, "Net-helper : recv_from_peer: buffer too small (size:%d > buffer_size: %d)!\n",size,buffer_size);
-		return -1;
+		size = -1;
+	} else {
+		memcpy(buffer_ptr, data, size);
 	}
-	memcpy(buffer_ptr, receivedBuffer[rIdxUp].data, size);
-	free(receivedBuffer[rIdxUp].data);
-	receivedBuffer[rIdxUp].data = NULL;
-	receivedBuffer[rIdxUp].id = NULL;
-
-	rIdxUp = (rIdxUp+1)%NH_BUFFER_SIZE;
-
-//	fprintf(stderr, "Net-helper : I've got mail!!!\n");
+	recv_buffer_free(data);
 
 	return size;
 }
 
 
+/**
+ * Make the persistent read events match the fd list (terminated by -1),
+ * recreating them only when the list changed
+ */
+static void fd_events_sync(const int *fds)
+{
+	int i, n;
+
+	for (n = 0; fds && fds[n] != -1; n++) {
+	  if (n >= FDSSIZE) {
+	    fprintf(stderr, "Can't listen on more than %d file descriptors!\n", FDSSIZE);
+	    break;
+	  }
+	  if (n < fd_ev_count) {
+	    if (fd_ev_fd[n] == fds[n]) continue;
+	    event_free(fd_ev[n]);
+	  }
+	  fd_ev[n] = event_new(base, fds[n], EV_READ | EV_PERSIST, &fd_cb, &fd_triggered[n]);
+	  fd_ev_fd[n] = fds[n];
+	  fd_triggered[n] = false;
+	  event_add(fd_ev[n], NULL);
+	}
+	for (i = n; i < fd_ev_count; i++) {
+	  event_free(fd_ev[i]);
+	}
+	fd_ev_count = n;
+}
+
 int wait4data(const struct nodeID *n, struct timeval *tout, int *fds) {
 
-	struct event *timeout_ev = NULL;
-	struct event *fd_ev[FDSSIZE];
-	bool fd_triggered[FDSSIZE] = { false };
 	int i;
 
 //	fprintf(stderr,"Net-helper : Waiting for data to come...\n");
 	if (tout) {	//if tout==NULL, loop wait infinitely
-	  timeout_ev = event_new(base, -1, EV_TIMEOUT, &t_out_cb, NULL);
+	  if (!timeout_ev) timeout_ev = evtimer_new(base, &t_out_cb, NULL);
 	  event_add(timeout_ev, tout);
 	}
-	for (i = 0; fds && fds[i] != -1; i ++) {
-	  if (i >= FDSSIZE) {
-	    fprintf(stderr, "Can't listen on more than %d file descriptors!\n", FDSSIZE);
-	    break;
-	  }
-	  fd_ev[i] = event_new(base, fds[i], EV_READ, &fd_cb, &fd_triggered[i]);
-	  event_add(fd_ev[i], NULL);
-	}
+	fd_events_sync(fds);
 
-	while(receivedBuffer[rIdxUp].data==NULL && timeoutFired==0 && fdTriggered==0) {
+	while(!recv_pending && timeoutFired==0 && fdTriggered==0) {
 	//	event_base_dispatch(base);
 		event_base_loop(base,EVLOOP_ONCE);
 	}
 
-	//delete one-time events
-	if (timeout_ev) {
-	  if (!timeoutFired) event_del(timeout_ev);
-	  event_free(timeout_ev);
-	}
-	for (i = 0; fds && fds[i] != -1; i ++) {
+	//disarm the timer, read events stay registered for the next call
+	if (tout && !timeoutFired) event_del(timeout_ev);
+	for (i = 0; i < fd_ev_count; i++) {
 	  if (! fd_triggered[i]) {
 	    fds[i] = -2;
-	    event_del(fd_ev[i]);
-	  //} else {
-	    //fprintf(stderr, "\twait4data: fd %d triggered\n", fds[i]);
 	  }
-	  event_free(fd_ev[i]);
+	  fd_triggered[i] = false;
 	}
 
 	if (fdTriggered) {
@@ -677,7 +1091,7 @@ int wait4data(const struct nodeID *n, struct timeval *tout, int *fds) {
 	  timeoutFired = 0;
 	  //fprintf(stderr, "\twait4data: timed out\n");
 	  return 0;
-	} else if (receivedBuffer[rIdxUp].data!=NULL) {
+	} else if (recv_pending) {
 	  //fprintf(stderr, "\twait4data: ML receive\n");
 	  return 1;
 	} else {
@@ -729,17 +1143,13 @@ int node_ip(const struct nodeID *s, char *ip, int size) {
 	return 1;
 }
 
+// Nodes left with the lookup table reference only are evicted lazily by lookup_make_room()
 // TODO: check why closing the connection is annoying for the ML
 void nodeid_free(struct nodeID *n) {
-	if (n && (--(n->refcnt) == 1)) {
-/*
-		struct nodeID **npos;
-	//	mlCloseConnection(n->connID);
-		npos = id_lookup(n->addr);
-		*npos = NULL;
-		mlCloseSocket(n->addr);
-		free(n);
-*/
+	if (n) {
+		nodeid_lock();
+		--(n->refcnt);
+		nodeid_unlock();
 	}
 }
 
@@ -756,7 +1166,9 @@ int node_addr(const struct nodeID *s, char *addr, int len)
 
 struct nodeID *nodeid_dup(struct nodeID *s)
 {
+	nodeid_lock();
 	s->refcnt++;
+	nodeid_unlock();
 	return s;
 }
 
@@ -787,6 +1199,8 @@ struct nodeID *nodeid_undump(const uint8_t *b, int *len)
 {
   uint8_t sid[SOCKETID_SIZE];
   socketID_handle h = (socketID_handle) sid;
+
+  memset(sid, 0, sizeof(sid));	// padding must not leak into the stored addr
   mlStringToSocketID((const char *)b,h);
   *len = strlen((const char*)b) + 1;
   return id_lookup_dup(h);
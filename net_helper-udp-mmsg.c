@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+ * Streamer-side UDP net helper batching datagrams with recvmmsg/sendmmsg.
+ *
+ * Messages larger than NH_UDP_FRAG_SIZE are split in fragments, each
+ * datagram carrying a small header to reassemble them. Sends are queued and
+ * flushed with one sendmmsg when wait4data is entered (i.e., once per loop
+ * iteration) or when the batch is full. THREADS builds receive and send on
+ * different threads: there the batch belongs to the sending thread, which
+ * flushes it with send_flush, and wait4data leaves it alone. Receive
+ * buffers are recycled, and handed over to the caller through the NH_EXT
+ * interface.
+ * Where recvmmsg/sendmmsg are not available, they are emulated with one
+ * recvmsg/sendmsg per datagram.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// recvmmsg, sendmmsg
+#endif
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
+#include <net_helper.h>
+
+#include "net_helper_ext.h"
+
+#define NH_UDP_FRAG_SIZE 60000	// payload bytes per datagram
+#define NH_UDP_BATCH 32	// datagrams per recvmmsg/sendmmsg
+#define NH_UDP_RXQ 256	// received msgs waiting to be handed up
+#define NH_UDP_REASM_SLOTS 16	// msgs being reassembled at the same time
+#define NH_UDP_MAX_FRAGS 64	// fragments per msg, one bit each in struct reasm
+#define NH_UDP_POOL_MAX 64	// idle receive buffers kept for reuse
+
+struct nodeID {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int refcnt;
+	int fd;	// only meaningful for the local node
+};
+
+struct frag_hdr {
+	uint32_t seq;
+	uint16_t frag;
+	uint16_t nfrags;
+} __attribute__((packed));
+
+// buffers handed to the upper layer: data is what the caller gets
+struct nh_buf {
+	size_t size;
+	uint8_t data[];
+};
+
+struct rx_msg {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct nh_buf *buf;
+	int len;
+};
+
+struct reasm {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	uint32_t seq;
+	uint16_t nfrags;
+	uint16_t received;
+	uint64_t frags;	// bitmap of the fragments received so far
+	int len;
+	uint64_t last_used;
+	struct nh_buf *buf;	// NULL if the slot is free
+};
+
+#if !defined(__linux__)
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+static int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags, struct timespec *tout)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		ssize_t res = recvmsg(fd, &msgs[i].msg_hdr, flags);
+
+		if (res < 0) return i ? (int)i : -1;
+		msgs[i].msg_len = res;
+	}
+	return i;
+}
+
+static int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int n, int flags)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		ssize_t res = sendmsg(fd, &msgs[i].msg_hdr, flags);
+
+		if (res < 0) return i ? (int)i : -1;
+		msgs[i].msg_len = res;
+	}
+	return i;
+}
+#endif
+
+static int sock = -1;
+static uint32_t tx_seq;
+static uint64_t reasm_clock;
+
+static struct nh_buf *pool[NH_UDP_POOL_MAX];
+static int pool_count;
+
+#ifdef THREADS
+// received buffers are released by the threads the msgs are handed to
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define pool_lock() pthread_mutex_lock(&pool_mutex)
+#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
+#else
+#define pool_lock()
+#define pool_unlock()
+#endif
+
+static struct mmsghdr rx_msgs[NH_UDP_BATCH];
+static struct iovec rx_iov[NH_UDP_BATCH][2];
+static struct frag_hdr rx_hdr[NH_UDP_BATCH];
+static struct nh_buf *rx_buf[NH_UDP_BATCH];
+static struct sockaddr_storage rx_addr[NH_UDP_BATCH];
+
+static struct rx_msg rxq[NH_UDP_RXQ];
+static int rxq_head, rxq_count;
+
+static struct reasm reasm_slots[NH_UDP_REASM_SLOTS];
+
+static struct mmsghdr tx_msgs[NH_UDP_BATCH];
+static struct iovec tx_iov[NH_UDP_BATCH][2];
+static struct frag_hdr tx_hdr[NH_UDP_BATCH];
+static uint8_t *tx_buf[NH_UDP_BATCH];
+static struct sockaddr_storage tx_addr[NH_UDP_BATCH];	// the nodeID might be gone by the flush
+static int tx_count;
+
+
+static struct nh_buf *buf_get(size_t size)
+{
+	struct nh_buf *b = NULL;
+
+	if (size == NH_UDP_FRAG_SIZE) {
+		pool_lock();
+		if (pool_count) b = pool[--pool_count];
+		pool_unlock();
+		if (b) return b;
+	}
+	b = malloc(sizeof(struct nh_buf) + size);
+	if (b) b->size = size;
+
+	return b;
+}
+
+static void buf_put(struct nh_buf *b)
+{
+	if (b->size == NH_UDP_FRAG_SIZE) {
+		pool_lock();
+		if (pool_count < NH_UDP_POOL_MAX) {
+			pool[pool_count++] = b;
+			b = NULL;
+		}
+		pool_unlock();
+	}
+	free(b);
+}
+
+static bool addr_equal(const struct sockaddr_storage *a, socklen_t alen, const struct sockaddr_storage *b, socklen_t blen)
+{
+	return alen == blen && memcmp(a, b, alen) == 0;
+}
+
+static struct nodeID *node_new(const struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	struct nodeID *res = malloc(sizeof(struct nodeID));
+
+	if (res) {
+		memset(res, 0, sizeof(struct nodeID));
+		memcpy(&res->addr, addr, addrlen);
+		res->addrlen = addrlen;
+		res->refcnt = 1;
+		res->fd = -1;
+	}
+
+	return res;
+}
+
+static int addr_parse(const char *ip, int port, struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+	struct sockaddr_in *a4 = (struct sockaddr_in *)addr;
+	struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)addr;
+
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	if (inet_pton(AF_INET, ip, &a4->sin_addr) == 1) {
+		a4->sin_family = AF_INET;
+		a4->sin_port = htons(port);
+		*addrlen = sizeof(struct sockaddr_in);
+	} else if (inet_pton(AF_INET6, ip, &a6->sin6_addr) == 1) {
+		a6->sin6_family = AF_INET6;
+		a6->sin6_port = htons(port);
+		*addrlen = sizeof(struct sockaddr_in6);
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+struct nodeID *create_node(const char *IPaddr, int port)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	if (addr_parse(IPaddr, port, &addr, &addrlen) < 0) {
+		fprintf(stderr, "Net-helper: can't parse address %s\n", IPaddr);
+		return NULL;
+	}
+
+	return node_new(&addr, addrlen);
+}
+
+struct nodeID *nodeid_dup(struct nodeID *s)
+{
+	s->refcnt++;
+
+	return s;
+}
+
+void nodeid_free(struct nodeID *s)
+{
+	if (s && --s->refcnt == 0) {
+		free(s);
+	}
+}
+
+int nodeid_equal(const struct nodeID *s1, const struct nodeID *s2)
+{
+	return addr_equal(&s1->addr, s1->addrlen, &s2->addr, s2->addrlen);
+}
+
+int nodeid_cmp(const struct nodeID *s1, const struct nodeID *s2)
+{
+	int res;
+
+	if (s1->addrlen != s2->addrlen) {
+		return s1->addrlen < s2->addrlen ? -1 : 1;
+	}
+	res = memcmp(&s1->addr, &s2->addr, s1->addrlen);
+
+	return res < 0 ? -1 : (res > 0 ? 1 : 0);
+}
+
+int node_ip(const struct nodeID *s, char *ip, int len)
+{
+	const void *a;
+
+	if (s->addr.ss_family == AF_INET) {
+		a = &((const struct sockaddr_in *)&s->addr)->sin_addr;
+	} else {
+		a = &((const struct sockaddr_in6 *)&s->addr)->sin6_addr;
+	}
+
+	return inet_ntop(s->addr.ss_family, a, ip, len) ? 0 : -1;
+}
+
+int node_port(const struct nodeID *s)
+{
+	if (s->addr.ss_family == AF_INET) {
+		return ntohs(((const struct sockaddr_in *)&s->addr)->sin_port);
+	}
+
+	return ntohs(((const struct sockaddr_in6 *)&s->addr)->sin6_port);
+}
+
+int node_addr(const struct nodeID *s, char *addr, int len)
+{
+	char ip[INET6_ADDRSTRLEN];
+	int n;
+
+	if (node_ip(s, ip, sizeof(ip)) < 0) {
+		return -1;
+	}
+	n = snprintf(addr, len, "%s:%d", ip, node_port(s));
+
+	return n < len ? n : -1;
+}
+
+int nodeid_dump(uint8_t *b, const struct nodeID *s, size_t max_write_size)
+{
+	int n = node_addr(s, (char *)b, max_write_size);
+
+	return n < 0 ? -1 : n + 1;
+}
+
+struct nodeID *nodeid_undump(const uint8_t *b, int *len)
+{
+	char ip[INET6_ADDRSTRLEN + 8];
+	const char *port;
+	size_t l = strlen((const char *)b);
+
+	*len = l + 1;
+	port = strrchr((const char *)b, ':');
+	if (!port || port - (const char *)b >= (int)sizeof(ip)) {
+		return NULL;
+	}
+	memcpy(ip, b, port - (const char *)b);
+	ip[port - (const char *)b] = 0;
+
+	return create_node(ip, atoi(port + 1));
+}
+
+struct nodeID *net_helper_init(const char *IPaddr, int port, const char *config)
+{
+	struct nodeID *me;
+	int i;
+
+	me = create_node(IPaddr, port);
+	if (!me) {
+		return NULL;
+	}
+	sock = socket(me->addr.ss_family, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("Net-helper: socket");
+		nodeid_free(me);
+		return NULL;
+	}
+	if (bind(sock, (struct sockaddr *)&me->addr, me->addrlen) < 0) {
+		perror("Net-helper: bind");
+		close(sock);
+		nodeid_free(me);
+		return NULL;
+	}
+	me->fd = sock;
+
+	for (i = 0; i < NH_UDP_BATCH; i++) {
+		rx_iov[i][0].iov_base = &rx_hdr[i];
+		rx_iov[i][0].iov_len = sizeof(struct frag_hdr);
+		rx_msgs[i].msg_hdr.msg_iov = rx_iov[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 2;
+		tx_iov[i][0].iov_base = &tx_hdr[i];
+		tx_iov[i][0].iov_len = sizeof(struct frag_hdr);
+		tx_msgs[i].msg_hdr.msg_iov = tx_iov[i];
+		tx_msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	return me;
+}
+
+void bind_msg_type(uint8_t msgtype)
+{
+}
+
+void send_flush(void)
+{
+	int sent = 0, res;
+
+	while (sent < tx_count) {
+		res = sendmmsg(sock, tx_msgs + sent, tx_count - sent, 0);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			perror("Net-helper: sendmmsg");	// drop the failing datagram only
+			sent++;
+			continue;
+		}
+		sent += res;
+	}
+	tx_count = 0;
+}
+
+int send_to_peer(const struct nodeID *from, struct nodeID *to, const uint8_t *buffer_ptr, int buffer_size)
+{
+	uint16_t frag, nfrags;
+
+	if (buffer_size <= 0) {
+		fprintf(stderr,"Net-helper: message size problematic: %d\n", buffer_size);
+		return buffer_size;
+	}
+	if ((buffer_size + NH_UDP_FRAG_SIZE - 1) / NH_UDP_FRAG_SIZE > NH_UDP_MAX_FRAGS) {
+		fprintf(stderr,"Net-helper: message too large: %d\n", buffer_size);
+		return -1;
+	}
+	nfrags = (buffer_size + NH_UDP_FRAG_SIZE - 1) / NH_UDP_FRAG_SIZE;
+	tx_seq++;
+
+	for (frag = 0; frag < nfrags; frag++) {
+		int offset = frag * NH_UDP_FRAG_SIZE;
+		int len = buffer_size - offset < NH_UDP_FRAG_SIZE ? buffer_size - offset : NH_UDP_FRAG_SIZE;
+		struct msghdr *h;
+
+		if (tx_count == NH_UDP_BATCH) {
+			send_flush();
+		}
+		if (!tx_buf[tx_count]) {
+			tx_buf[tx_count] = malloc(NH_UDP_FRAG_SIZE);
+			if (!tx_buf[tx_count]) {
+				fprintf(stderr,"Net-helper: memory full, can't send!\n");
+				return -1;
+			}
+		}
+		memcpy(tx_buf[tx_count], buffer_ptr + offset, len);
+		tx_hdr[tx_count].seq = htonl(tx_seq);
+		tx_hdr[tx_count].frag = htons(frag);
+		tx_hdr[tx_count].nfrags = htons(nfrags);
+		tx_iov[tx_count][1].iov_base = tx_buf[tx_count];
+		tx_iov[tx_count][1].iov_len = len;
+		memcpy(&tx_addr[tx_count], &to->addr, to->addrlen);
+		h = &tx_msgs[tx_count].msg_hdr;
+		h->msg_name = &tx_addr[tx_count];
+		h->msg_namelen = to->addrlen;
+		tx_count++;
+	}
+
+	return buffer_size;
+}
+
+static void rxq_push(const struct sockaddr_storage *addr, socklen_t addrlen, struct nh_buf *buf, int len)
+{
+	struct rx_msg *m = &rxq[(rxq_head + rxq_count) % NH_UDP_RXQ];
+
+	memcpy(&m->addr, addr, addrlen);
+	m->addrlen = addrlen;
+	m->buf = buf;
+	m->len = len;
+	rxq_count++;
+}
+
+static void reasm_add(const struct sockaddr_storage *addr, socklen_t addrlen, const struct frag_hdr *h, const uint8_t *data, int len)
+{
+	struct reasm *r = NULL, *victim = &reasm_slots[0];
+	uint32_t seq = ntohl(h->seq);
+	uint16_t frag = ntohs(h->frag), nfrags = ntohs(h->nfrags);
+	int i;
+
+	if (frag >= nfrags || nfrags > NH_UDP_MAX_FRAGS || len > NH_UDP_FRAG_SIZE || (frag < nfrags - 1 && len != NH_UDP_FRAG_SIZE)) {
+		return;	// malformed
+	}
+	for (i = 0; i < NH_UDP_REASM_SLOTS; i++) {
+		struct reasm *s = &reasm_slots[i];
+
+		if (s->buf && s->seq == seq && addr_equal(&s->addr, s->addrlen, addr, addrlen)) {
+			r = s;
+			break;
+		}
+		if (!s->buf || (victim->buf && s->last_used < victim->last_used)) {
+			victim = s;
+		}
+	}
+	if (!r) {	// new msg: take a free slot, or give up on the least recently used one
+		r = victim;
+		if (r->buf) free(r->buf);
+		r->buf = buf_get((size_t)nfrags * NH_UDP_FRAG_SIZE);
+		if (!r->buf) return;
+		memcpy(&r->addr, addr, addrlen);
+		r->addrlen = addrlen;
+		r->seq = seq;
+		r->nfrags = nfrags;
+		r->received = 0;
+		r->frags = 0;
+		r->len = 0;
+	}
+	if (r->nfrags != nfrags) return;
+	r->last_used = ++reasm_clock;
+	if (r->frags & (1ULL << frag)) return;	// duplicate
+	memcpy(r->buf->data + (size_t)frag * NH_UDP_FRAG_SIZE, data, len);
+	r->frags |= 1ULL << frag;
+	r->received++;
+	if (frag == nfrags - 1) {
+		r->len = frag * NH_UDP_FRAG_SIZE + len;
+	}
+	if (r->received == r->nfrags) {
+		rxq_push(&r->addr, r->addrlen, r->buf, r->len);
+		r->buf = NULL;
+	}
+}
+
+/*
+ * Drain the socket with recvmmsg, as long as the receive queue can hold a full batch
+ * @return the number of datagrams read, -1 on error
+ */
+static int recv_batch(void)
+{
+	int i, n, total = 0;
+
+	while (NH_UDP_RXQ - rxq_count >= NH_UDP_BATCH) {
+		for (i = 0; i < NH_UDP_BATCH; i++) {
+			if (!rx_buf[i]) {
+				rx_buf[i] = buf_get(NH_UDP_FRAG_SIZE);
+				if (!rx_buf[i]) return -1;
+			}
+			rx_iov[i][1].iov_base = rx_buf[i]->data;
+			rx_iov[i][1].iov_len = NH_UDP_FRAG_SIZE;
+			rx_msgs[i].msg_hdr.msg_name = &rx_addr[i];
+			rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		}
+		n = recvmmsg(sock, rx_msgs, NH_UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			perror("Net-helper: recvmmsg");
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			int len = (int)rx_msgs[i].msg_len - (int)sizeof(struct frag_hdr);
+			socklen_t alen = rx_msgs[i].msg_hdr.msg_namelen;
+
+			if (len <= 0) continue;
+			if (ntohs(rx_hdr[i].nfrags) == 1 && rx_hdr[i].frag == 0) {
+				rxq_push(&rx_addr[i], alen, rx_buf[i], len);	// hand over the buffer itself
+				rx_buf[i] = NULL;
+			} else {
+				reasm_add(&rx_addr[i], alen, &rx_hdr[i], rx_buf[i]->data, len);
+			}
+		}
+		total += n;
+		if (n < NH_UDP_BATCH) break;
+	}
+
+	return total;
+}
+
+int wait4data(const struct nodeID *n, struct timeval *tout, int *user_fds)
+{
+	struct timespec deadline, now;
+
+#ifndef THREADS
+	send_flush();
+#endif
+	if (tout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += tout->tv_sec;
+		deadline.tv_nsec += tout->tv_usec * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	while (rxq_count == 0) {
+		fd_set fds;
+		struct timeval left, *pleft = NULL;
+		int i, res, maxfd = sock;
+
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		for (i = 0; user_fds && user_fds[i] != -1; i++) {
+			FD_SET(user_fds[i], &fds);
+			if (user_fds[i] > maxfd) maxfd = user_fds[i];
+		}
+		if (tout) {
+			int64_t us;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			us = (deadline.tv_sec - now.tv_sec) * 1000000LL + (deadline.tv_nsec - now.tv_nsec) / 1000;
+			if (us < 0) us = 0;
+			left.tv_sec = us / 1000000;
+			left.tv_usec = us % 1000000;
+			pleft = &left;
+		}
+		res = select(maxfd + 1, &fds, NULL, NULL, pleft);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			perror("Net-helper: select");
+			return -1;
+		}
+		if (res == 0) {
+			return 0;
+		}
+		if (FD_ISSET(sock, &fds)) {
+			recv_batch();
+		}
+		if (user_fds && !FD_ISSET(sock, &fds)) {
+			for (i = 0; user_fds[i] != -1; i++) {
+				if (!FD_ISSET(user_fds[i], &fds)) {
+					user_fds[i] = -2;
+				}
+			}
+			return 2;
+		}
+	}
+
+	return 1;
+}
+
+int recv_from_peer_nocopy(const struct nodeID *local, struct nodeID **remote, uint8_t **buffer_ptr)
+{
+	struct rx_msg *m;
+
+	while (rxq_count == 0) {	//block till first message arrives
+		if (wait4data(local, NULL, NULL) < 0) {
+			*remote = NULL;
+			return -1;
+		}
+	}
+	m = &rxq[rxq_head];
+	rxq_head = (rxq_head + 1) % NH_UDP_RXQ;
+	rxq_count--;
+
+	*remote = node_new(&m->addr, m->addrlen);
+	*buffer_ptr = m->buf->data;
+
+	return m->len;
+}
+
+void recv_buffer_free(uint8_t *buffer_ptr)
+{
+	if (buffer_ptr) {
+		buf_put((struct nh_buf *)(buffer_ptr - offsetof(struct nh_buf, data)));
+	}
+}
+
+int recv_from_peer(const struct nodeID *local, struct nodeID **remote, uint8_t *buffer_ptr, int buffer_size)
+{
+	int size;
+	uint8_t *data;
+
+	size = recv_from_peer_nocopy(local, remote, &data);
+	if (size < 0) {
+		return size;
+	}
+	if (size > buffer_size) {
+		fprintf(stderr, "Net-helper : recv_from_peer: buffer too small (size:%d > buffer_size: %d)!\n",size,buffer_size);
+		size = -1;
+	} else {
+		memcpy(buffer_ptr, data, size);
+	}
+	recv_buffer_free(data);
+
+	return size;
+}
+
+bool send_congested(void)
+{
+#ifdef SIOCOUTQ
+	int queued, sndbuf;
+	socklen_t l = sizeof(sndbuf);
+
+	if (ioctl(sock, SIOCOUTQ, &queued) == 0 && getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &l) == 0) {
+		return queued > sndbuf / 2;
+	}
+#endif
+	return false;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef NET_HELPER_EXT_H
+#define NET_HELPER_EXT_H
+
+/**
+* @file net_helper_ext.h
+*
+* @brief Streamer specific extensions to the GRAPES net_helper interface.
+*
+* Only available when the selected net helper defines NH_EXT (see Makefile).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct nodeID;
+
+/**
+* @brief Receive data from a remote peer, handing over the received buffer.
+*
+* Same as recv_from_peer, but instead of copying the message in a caller
+* provided buffer, the net helper hands over the buffer the message was stored
+* in. From then on the buffer is owned by the caller, which has to release it
+* with recv_buffer_free.
+* @param[in] local A pointer to the nodeID representing the caller.
+* @param[out] remote The address to a pointer that has to be set to a new nodeID representing the sender peer.
+* @param[out] buffer_ptr The address to a pointer that is set to the received message.
+* @return The number of received bytes or -1 if some error occurred.
+*/
+int recv_from_peer_nocopy(const struct nodeID *local, struct nodeID **remote, uint8_t **buffer_ptr);
+
+/**
+* @brief Release a buffer obtained from recv_from_peer_nocopy.
+*
+* @param[in] buffer_ptr The buffer to be released.
+*/
+void recv_buffer_free(uint8_t *buffer_ptr);
+
+/**
+* @brief Hand the queued messages over to the network.
+*
+* A net helper may batch what send_to_peer gets and flush it when wait4data
+* is entered. THREADS builds do not wait on the sending thread, which calls
+* this instead once it has nothing more to send.
+*/
+void send_flush(void);
+
+/**
+* @brief Check whether the net helper is short of send slots.
+*
+* Messages sent while the net helper is congested are likely to be dropped,
+* so callers generating optional traffic (offers, pushed chunks) should
+* rather skip a round.
+* @return true if less than the configured low watermark of slots is free.
+*/
+bool send_congested(void);
+
+#endif	/* NET_HELPER_EXT_H */
@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "nodeid_map.h"
+
+struct nodeid_map_entry {
+	uint8_t * key;
+	int key_len;
+	uint32_t hash;
+	void * value;
+	struct nodeid_map_entry * next;
+};
+
+struct nodeid_map {
+	struct nodeid_map_entry ** buckets;
+	uint32_t size;
+	uint32_t n_elements;
+};
+
+/* FNV-1a */
+static uint32_t nodeid_map_hash(const uint8_t * key,const int len)
+{
+	uint32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < len; i++)
+	{
+		h ^= key[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int nodeid_map_key(const struct nodeID * id,uint8_t * key)
+{
+	if (id)
+		return nodeid_dump(key,id,NODEID_MAP_KEY_SIZE);
+	return -1;
+}
+
+static int nodeid_map_init(struct nodeid_map * nm,const uint32_t size)
+{
+	if(nm)
+	{
+		nm->size = size > 0 ? size : NODEID_MAP_INIT_SIZE;
+		nm->n_elements = 0;
+		nm->buckets = (struct nodeid_map_entry **) calloc(nm->size,sizeof(struct nodeid_map_entry *));
+	}
+	return nm == NULL || nm->buckets == NULL ? -1 : 0;
+}
+
+struct nodeid_map * nodeid_map_new(const uint32_t size)
+{
+	struct nodeid_map * nm = NULL;
+
+	nm = (struct nodeid_map *) malloc(sizeof(struct nodeid_map));
+	if (nm && nodeid_map_init(nm,size) < 0)
+	{
+		free(nm);
+		nm = NULL;
+	}
+	return nm;
+}
+
+void nodeid_map_destroy(struct nodeid_map ** nm)
+{
+	struct nodeid_map_entry * e, * next;
+	uint32_t i;
+
+	if(*nm)
+	{
+		for (i = 0; i < (*nm)->size; i++)
+			for (e = (*nm)->buckets[i]; e; e = next)
+			{
+				next = e->next;
+				free(e->key);
+				free(e);
+			}
+		free((*nm)->buckets);
+		free(*nm);
+		*nm = NULL;
+	}
+}
+
+static struct nodeid_map_entry * nodeid_map_lookup(const struct nodeid_map * nm,const uint8_t * key,const int len,const uint32_t hash)
+{
+	struct nodeid_map_entry * e;
+
+	for (e = nm->buckets[hash % nm->size]; e; e = e->next)
+		if (e->hash == hash && e->key_len == len && memcmp(e->key,key,len) == 0)
+			return e;
+	return NULL;
+}
+
+static void nodeid_map_grow(struct nodeid_map * nm)
+{
+	struct nodeid_map_entry ** buckets;
+	struct nodeid_map_entry * e, * next;
+	uint32_t i, size;
+
+	size = nm->size * 2;
+	buckets = (struct nodeid_map_entry **) calloc(size,sizeof(struct nodeid_map_entry *));
+	if (buckets == NULL)
+		return;	// keep working with longer chains
+
+	for (i = 0; i < nm->size; i++)
+		for (e = nm->buckets[i]; e; e = next)
+		{
+			next = e->next;
+			e->next = buckets[e->hash % size];
+			buckets[e->hash % size] = e;
+		}
+	free(nm->buckets);
+	nm->buckets = buckets;
+	nm->size = size;
+}
+
+int nodeid_map_insert(struct nodeid_map * nm,const struct nodeID * id,void * value)
+{
+	uint8_t key[NODEID_MAP_KEY_SIZE];
+	struct nodeid_map_entry * e;
+	uint32_t hash;
+	int len;
+
+	if (nm == NULL || (len = nodeid_map_key(id,key)) < 0)
+		return -1;
+
+	hash = nodeid_map_hash(key,len);
+	e = nodeid_map_lookup(nm,key,len,hash);
+	if (e)
+	{
+		e->value = value;
+		return 0;
+	}
+
+	e = (struct nodeid_map_entry *) malloc(sizeof(struct nodeid_map_entry));
+	if (e == NULL)
+		return -1;
+	e->key = (uint8_t *) malloc(len);
+	if (e->key == NULL)
+	{
+		free(e);
+		return -1;
+	}
+	memcpy(e->key,key,len);
+	e->key_len = len;
+	e->hash = hash;
+	e->value = value;
+	e->next = nm->buckets[hash % nm->size];
+	nm->buckets[hash % nm->size] = e;
+	nm->n_elements++;
+
+	if (nm->n_elements > nm->size)
+		nodeid_map_grow(nm);
+	return 0;
+}
+
+void * nodeid_map_get(const struct nodeid_map * nm,const struct nodeID * id)
+{
+	uint8_t key[NODEID_MAP_KEY_SIZE];
+	struct nodeid_map_entry * e;
+	int len;
+
+	if (nm == NULL || (len = nodeid_map_key(id,key)) < 0)
+		return NULL;
+
+	e = nodeid_map_lookup(nm,key,len,nodeid_map_hash(key,len));
+	return e ? e->value : NULL;
+}
+
+void * nodeid_map_remove(struct nodeid_map * nm,const struct nodeID * id)
+{
+	uint8_t key[NODEID_MAP_KEY_SIZE];
+	struct nodeid_map_entry ** pe, * e;
+	uint32_t hash;
+	void * value;
+	int len;
+
+	if (nm == NULL || (len = nodeid_map_key(id,key)) < 0)
+		return NULL;
+
+	hash = nodeid_map_hash(key,len);
+	for (pe = &(nm->buckets[hash % nm->size]); *pe; pe = &((*pe)->next))
+	{
+		e = *pe;
+		if (e->hash == hash && e->key_len == len && memcmp(e->key,key,len) == 0)
+		{
+			*pe = e->next;
+			value = e->value;
+			free(e->key);
+			free(e);
+			nm->n_elements--;
+			return value;
+		}
+	}
+	return NULL;
+}
+
+uint32_t nodeid_map_size(const struct nodeid_map * nm)
+{
+	if (nm)
+		return nm->n_elements;
+	return 0;
+}
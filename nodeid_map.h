@@ -0,0 +1,24 @@
+#ifndef __NODEID_MAP_H__
+#define __NODEID_MAP_H__ 1
+
+#include <stdint.h>
+#include <net_helper.h>
+
+#define NODEID_MAP_INIT_SIZE 64
+#define NODEID_MAP_KEY_SIZE 256
+
+/* hash map associating a nodeID (keyed on its nodeid_dump form) to an opaque pointer */
+
+struct nodeid_map * nodeid_map_new(const uint32_t size);
+
+void nodeid_map_destroy(struct nodeid_map ** nm);
+
+int nodeid_map_insert(struct nodeid_map * nm,const struct nodeID * id,void * value);
+
+void * nodeid_map_get(const struct nodeid_map * nm,const struct nodeID * id);
+
+void * nodeid_map_remove(struct nodeid_map * nm,const struct nodeID * id);
+
+uint32_t nodeid_map_size(const struct nodeid_map * nm);
+
+#endif
@@ -30,9 +30,11 @@
 #include "output.h"
 #include "measures.h"
 #include "dbg.h"
+#include "chunk_pool.h"
 
 static int last_chunk = -1;
 static int next_chunk = -1;
+static int newest_chunk = -1;
 static int buff_size;
 extern bool chunk_log;
 extern int start_id;
@@ -48,6 +50,8 @@ struct outbuf {
 };
 static struct outbuf *buff;
 static struct output_stream *out;
+static output_gap_cb gap_cb;
+static int gap_next = -1;	// holes below this were already reported
 
 void output_init(int bufsize, const char *config)
 {
@@ -118,13 +122,35 @@ static void buffer_free(int i)
     }
   }
 
-  free(buff[i].c.data);
+  chunk_pool_free(buff[i].c.data, buff[i].c.size);
   buff[i].c.data = NULL;
   dprintf("Next Chunk: %d -> %d\n", next_chunk, buff[i].c.id + 1);
   reg_chunk_playout(buff[i].c.id, true, buff[i].c.timestamp);
   next_chunk = buff[i].c.id + 1;
 }
 
+/*
+ * Report the holes in the older half of the reorder window: they are
+ * skipped unless they arrive before newer chunks push the window past them.
+ * Each hole is reported once, when it enters the older half, so a delivery
+ * costs one callback per id the window advanced by; re-asking for a hole is
+ * left to the callback owner.
+ */
+static void gaps_report(void)
+{
+  int i;
+
+  if (!gap_cb) {
+    return;
+  }
+  for (i = gap_next > next_chunk ? gap_next : next_chunk; i <= newest_chunk - buff_size / 2; i++) {
+    if (!buff[i % buff_size].c.data) {
+      gap_cb(i);
+    }
+  }
+  gap_next = i;
+}
+
 static void buffer_flush(int id)
 {
   int i = id % buff_size;
@@ -152,6 +178,9 @@ void output_deliver(const struct chunk *c)
   if (c->id < next_chunk) {
     return;
   }
+  if (c->id > newest_chunk) {
+    newest_chunk = c->id;
+  }
 
   /* Initialize buffer with first chunk */
   if (next_chunk == -1) {
@@ -212,7 +241,13 @@ void output_deliver(const struct chunk *c)
     }
     /* We previously flushed, so we know that c->id is free */
     memcpy(&buff[c->id % buff_size].c, c, sizeof(struct chunk));
-    buff[c->id % buff_size].c.data = malloc(c->size);
+    buff[c->id % buff_size].c.data = chunk_pool_alloc(c->size);
     memcpy(buff[c->id % buff_size].c.data, c->data, c->size);
   }
+  gaps_report();
+}
+
+void output_set_gap_cb(output_gap_cb cb)
+{
+  gap_cb = cb;
 }
@@ -26,4 +26,8 @@ struct chunk;
 void output_init(int bufsize, const char *config);
 void output_deliver(const struct chunk *c);
 
+/* called once for each missing chunk about to fall out of the reorder window */
+typedef void (*output_gap_cb)(int chunkid);
+void output_set_gap_cb(output_gap_cb cb);
+
 #endif	/* OUTPUT_H */
@@ -25,6 +25,7 @@
 #include "transaction.h"
 #include "measures.h"
 #include "dbg.h"
+#include "loop_clock.h"
 
 #define MAX(A,B)    ((A)>(B) ? (A) : (B))
 #define MIN(A,B)    ((A)<(B) ? (A) : (B))
@@ -78,7 +79,7 @@ static void update_period()
 
   if (! period_initial) period_initial = get_period();
 
-  gettimeofday(&t_now, NULL);
+  loop_now_tv(&t_now);
 
   dprintf("update_period: offer_accept=%f acc_to_ack=%f period=%lu\n", offer_accept, acc_to_ack, get_period());
 
@@ -131,8 +132,6 @@ void rc_reg_accept(uint16_t trans_id, int accepted)
 void rc_reg_ack(uint16_t trans_id)
 {
   double t_acc, t_acc_to_ack;
-  struct timeval t_now;
-
   t_acc = transaction_remove(trans_id);
 
   if (t_acc < 0) {
@@ -140,8 +139,7 @@ void rc_reg_ack(uint16_t trans_id)
     return;
   }
 
-  gettimeofday(&t_now, NULL);
-  t_acc_to_ack = t_now.tv_sec + t_now.tv_usec*1e-6 - t_acc;
+  t_acc_to_ack = loop_now_us() * 1e-6 - t_acc;	// same clock as the transaction timestamps
 
   update_acc_to_ack(t_acc_to_ack);
 }
\ No newline at end of file
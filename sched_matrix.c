@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <chunkidset.h>
+
+#include "sched_matrix.h"
+
+#define WORD_BITS 64
+
+static uint64_t *have;	// our fresh chunks
+static uint64_t *rows;	// peers_len rows of words each
+static size_t words;
+static size_t rows_len;
+static size_t capacity;	// words allocated for rows
+static int base;	// chunk id of bit 0
+
+static int grow(size_t peers_len, size_t w)
+{
+  uint64_t *p;
+
+  if (peers_len * w > capacity) {
+    p = realloc(rows, peers_len * w * sizeof(uint64_t));
+    if (!p) {
+      return -1;
+    }
+    rows = p;
+    capacity = peers_len * w;
+  }
+  if (w > words || !have) {
+    p = realloc(have, w * sizeof(uint64_t));
+    if (!p) {
+      return -1;
+    }
+    have = p;
+  }
+
+  return 0;
+}
+
+// keep only bits for ids >= lo
+static void mask_from(uint64_t *row, int lo)
+{
+  size_t w;
+  int bit = lo - base;
+
+  if (bit <= 0) {
+    return;
+  }
+  for (w = 0; w < words && (int)((w + 1) * WORD_BITS) <= bit; w++) {
+    row[w] = 0;
+  }
+  if (w < words) {
+    row[w] &= ~0ULL << (bit % WORD_BITS);
+  }
+}
+
+static void row_build(uint64_t *row, const struct peer *p)
+{
+  const struct chunkID_set *cset = p->bmap;
+  uint64_t has, cand;
+  size_t w;
+  int missing;
+
+  if (p->cb_size == 0) {	// it declared it does not need chunks
+    memset(row, 0, words * sizeof(uint64_t));
+    return;
+  }
+  memcpy(row, have, words * sizeof(uint64_t));
+  if (!cset || chunkID_set_size(cset) == 0) {	// no info: it needs everything
+    return;
+  }
+
+  missing = p->cb_size - chunkID_set_size(cset);
+  missing = missing < 0 ? 0 : missing;
+  mask_from(row, chunkID_set_get_earliest(cset) - missing);
+
+  for (w = 0; w < words; w++) {
+    has = 0;
+    for (cand = row[w]; cand; cand &= cand - 1) {
+      int bit = __builtin_ctzll(cand);
+
+      if (chunkID_set_check(cset, base + (int)(w * WORD_BITS) + bit) >= 0) {
+        has |= 1ULL << bit;
+      }
+    }
+    row[w] &= ~has;
+  }
+}
+
+void sched_matrix_build(struct peer **peers, size_t peers_len, const int *chunks, size_t chunks_len, schedChunkFilter fresh)
+{
+  int lo = INT_MAX, hi = INT_MIN;
+  size_t i, w;
+
+  rows_len = 0;
+  words = 0;
+  for (i = 0; i < chunks_len; i++) {
+    lo = chunks[i] < lo ? chunks[i] : lo;
+    hi = chunks[i] > hi ? chunks[i] : hi;
+  }
+  if (chunks_len == 0) {
+    return;
+  }
+
+  w = ((size_t)(hi - lo) + WORD_BITS) / WORD_BITS;
+  if (grow(peers_len, w) < 0) {
+    fprintf(stderr, "Memory allocation error in the scheduler!\n");
+    return;
+  }
+  words = w;
+  base = lo;
+  rows_len = peers_len;
+
+  memset(have, 0, words * sizeof(uint64_t));
+  for (i = 0; i < chunks_len; i++) {
+    int bit = chunks[i] - base;
+
+    if (!fresh || fresh(chunks[i])) {
+      have[bit / WORD_BITS] |= 1ULL << (bit % WORD_BITS);
+    }
+  }
+
+  for (i = 0; i < peers_len; i++) {
+    row_build(rows + i * words, peers[i]);
+  }
+}
+
+int sched_matrix_needs(size_t peer, int cid)
+{
+  int bit = cid - base;
+
+  if (peer >= rows_len || bit < 0 || bit >= (int)(words * WORD_BITS)) {
+    return 0;
+  }
+
+  return (rows[peer * words + bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+}
+
+static bool row_any(size_t peer, const uint64_t *mask)
+{
+  const uint64_t *row = rows + peer * words;
+  uint64_t acc = 0;
+  size_t w;
+
+  for (w = 0; w < words; w++) {
+    acc |= row[w] & mask[w];
+  }
+
+  return acc != 0;
+}
+
+void sched_matrix_select_peers(SchedOrdering ordering, struct peer **peers, const int *chunks, size_t chunks_len, struct peer **selected, size_t *selected_len, schedPeerWeight evaluate)
+{
+  uint64_t mask[words ? words : 1];
+  size_t cand[rows_len ? rows_len : 1];
+  double weight[rows_len ? rows_len : 1];
+  size_t n = 0, k = 0, i;
+  double sum = 0;
+
+  memset(mask, 0, sizeof(mask));
+  for (i = 0; i < chunks_len; i++) {
+    int bit = chunks[i] - base;
+
+    if (bit >= 0 && bit < (int)(words * WORD_BITS)) {
+      mask[bit / WORD_BITS] |= 1ULL << (bit % WORD_BITS);
+    }
+  }
+
+  for (i = 0; i < rows_len; i++) {
+    if (words && row_any(i, mask)) {
+      cand[n] = i;
+      weight[n] = evaluate ? evaluate(&peers[i]) : 1;
+      sum += weight[n];
+      n++;
+    }
+  }
+
+  while (k < *selected_len && n > 0) {
+    size_t j = 0;
+
+    if (ordering == SCHED_BEST) {
+      for (i = 1; i < n; i++) {
+        if (weight[i] > weight[j]) {
+          j = i;
+        }
+      }
+    } else {
+      double r = sum * (rand() / ((double)RAND_MAX + 1));
+
+      for (j = 0; j < n - 1 && r >= weight[j]; j++) {
+        r -= weight[j];
+      }
+    }
+    selected[k++] = peers[cand[j]];
+    sum -= weight[j];
+    cand[j] = cand[n - 1];	// without replacement
+    weight[j] = weight[n - 1];
+    n--;
+  }
+  *selected_len = k;
+}
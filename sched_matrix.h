@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2010-2011 Luca Abeni
+ * Copyright (c) 2010-2011 Csaba Kiraly
+ *
+ * This file is part of PeerStreamer.
+ *
+ * PeerStreamer is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * PeerStreamer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with PeerStreamer.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SCHED_MATRIX_H
+#define SCHED_MATRIX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <peer.h>
+#include <scheduler_common.h>
+
+/*
+ * Neighbours x chunk-window "needs" matrix, rebuilt once per scheduling tick.
+ * Row i is a bitset over the ids of the local buffer window telling which of
+ * our chunks neighbour i may need, with the semantics of needs() in
+ * streaming.c: what we have and is fresh, AND-NOT what the peer's buffermap
+ * says it has, limited to the window the peer can still store.
+ */
+
+/* called once per chunk and tick, 0 drops the chunk (e.g. too old) */
+typedef int (*schedChunkFilter)(int cid);
+
+/* same signature as GRAPES' peerEvaluateFunction */
+typedef double (*schedPeerWeight)(struct peer **p);
+
+void sched_matrix_build(struct peer **peers, size_t peers_len, const int *chunks, size_t chunks_len, schedChunkFilter fresh);
+
+int sched_matrix_needs(size_t peer, int cid);
+
+/*
+ * Selects up to *selected_len peers needing at least one of chunks, best or
+ * weighted-random according to ordering, like selectPeersForChunks().
+ * peers must be the array the matrix was built on.
+ */
+void sched_matrix_select_peers(SchedOrdering ordering, struct peer **peers, const int *chunks, size_t chunks_len, struct peer **selected, size_t *selected_len, schedPeerWeight evaluate);
+
+#endif	/* SCHED_MATRIX_H */
@@ -26,4 +26,8 @@
 #define SCHED_PEER	peerWeightUniform
 #define SCHED_CHUNK	chunkScoreChunkID
 
+/* 1: evaluate needs on a neighbours x window bitset built once per tick
+ * (sched_matrix.c) instead of calling SCHED_NEEDS per (peer, chunk) pair */
+#define SCHED_MATRIX	1
+
 #endif	/* SCHEDULING_H */
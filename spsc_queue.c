@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <malloc.h>
+
+#include "spsc_queue.h"
+
+#define CACHE_LINE 64
+
+struct spsc_queue {
+	void ** items;
+	uint32_t mask;
+	// written by the producer only, read by the consumer
+	uint32_t tail __attribute__((aligned(CACHE_LINE)));
+	uint32_t cached_head;
+	// written by the consumer only, read by the producer
+	uint32_t head __attribute__((aligned(CACHE_LINE)));
+	uint32_t cached_tail;
+};
+
+struct spsc_queue * spsc_queue_new(const uint32_t size)
+{
+	struct spsc_queue * q = NULL;
+	uint32_t n = 2;
+
+	while (n < size && n < (1U << 31))
+		n <<= 1;
+
+	q = (struct spsc_queue *) memalign(CACHE_LINE, sizeof(struct spsc_queue));
+	if (q)
+	{
+		q->items = (void **) malloc(n * sizeof(void *));
+		if (q->items == NULL)
+		{
+			free(q);
+			return NULL;
+		}
+		q->mask = n - 1;
+		q->head = q->tail = 0;
+		q->cached_head = q->cached_tail = 0;
+	}
+	return q;
+}
+
+void spsc_queue_destroy(struct spsc_queue **q)
+{
+	if (q && *q)
+	{
+		free((*q)->items);
+		free(*q);
+		*q = NULL;
+	}
+}
+
+int spsc_queue_push(struct spsc_queue *q, void *item)
+{
+	uint32_t tail;
+
+	if (q == NULL)
+		return -1;
+
+	tail = q->tail;
+	if (tail - q->cached_head > q->mask)
+	{
+		q->cached_head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - q->cached_head > q->mask)
+			return -1;
+	}
+	q->items[tail & q->mask] = item;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void * spsc_queue_pop(struct spsc_queue *q)
+{
+	uint32_t head;
+	void * item;
+
+	if (q == NULL)
+		return NULL;
+
+	head = q->head;
+	if (head == q->cached_tail)
+	{
+		q->cached_tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (head == q->cached_tail)
+			return NULL;
+	}
+	item = q->items[head & q->mask];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	return item;
+}
+
+uint32_t spsc_queue_length(const struct spsc_queue *q)
+{
+	if (q == NULL)
+		return 0;
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
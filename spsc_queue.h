@@ -0,0 +1,22 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__ 1
+
+#include <stdint.h>
+
+/*
+ * Bounded lock-free queue of pointers for exactly one producer thread and
+ * one consumer thread. The size is rounded up to a power of two.
+ */
+struct spsc_queue * spsc_queue_new(const uint32_t size);
+
+void spsc_queue_destroy(struct spsc_queue **q);
+
+/* producer side: returns -1 if the queue is full */
+int spsc_queue_push(struct spsc_queue *q, void *item);
+
+/* consumer side: returns NULL if the queue is empty */
+void * spsc_queue_pop(struct spsc_queue *q);
+
+uint32_t spsc_queue_length(const struct spsc_queue *q);
+
+#endif
@@ -48,12 +48,15 @@
 #include "measures.h"
 #include "streamer.h"
 #include "node_addr.h"
+#include "chunk_pool.h"
 #include "version.h"
 
 #ifndef EXTRAVERSION
 #define EXTRAVERSION "Unknown"
 #endif
 
+#define CHUNK_SIZE_TYPICAL (8 * 1024)	// a frame of a ~1.5 Mbit/s, 25 fps stream
+
 static struct nodeID *my_sock;
 
 const char *peername = NULL;
@@ -61,6 +64,11 @@ const char *peername = NULL;
 static uint16_t chunk_test_port = 60006;
 static const char *chunk_test_ip = "127.0.0.1";
 static int chunk_test_mtu = 1372;
+#ifdef THREADS
+static bool chunk_test = false;	// not supported by the threaded loop, only tried if asked for
+#else
+static bool chunk_test = true;
+#endif
 
 static const char *my_iface = NULL;
 static int port = 6666;
@@ -82,6 +90,10 @@ bool chunk_log = false;
 bool signal_log = false;
 bool neigh_log = false;
 bool push_strategy = false;
+bool edf_scheduling = false;
+bool prio_scheduling = false;
+bool urgent_requests = false;
+bool selective_offers = false;
 unsigned int chunk_loss_interval = 0;
 static int randomize_start = 0;
 int start_id = -1;
@@ -99,6 +111,9 @@ extern bool topo_in;
 extern bool topo_keep_best;
 extern bool topo_add_best;
 extern bool autotune_period;
+#ifdef THREADS
+extern int chunk_decoders;
+#endif
 extern enum L3PROTOCOL {IPv4, IPv6} l3;
 
 #ifndef MONL
@@ -135,6 +150,10 @@ static void print_usage(int argc, char *argv[])
     "\t         This name will be used when publishing in the repository.\n"
     "\t[-n options]: pass configuration options to the net-helper\n"
     "\t[--push_strategy]: use a loss-driven strategy for selecting peers in the source initial chunks push\n"
+    "\t[--edf_scheduling]: send chunks earliest deadline first, skipping those that cannot arrive in time\n"
+    "\t[--prio_scheduling]: offer and send high-priority chunks (e.g. keyframes) first, and offer them to more peers\n"
+    "\t[--urgent_requests]: request chunks missing close to playout from the fastest neighbour having them\n"
+    "\t[--selective_offers]: offer only the chunks the peer's last buffermap misses, to peers supporting it\n"
     "\t[--chunk_log]: print a chunk level log on stderr\n"
     "\t[--neighbourhood_log]: print neighbourhhod logs to stderr\n"
     "\t[--signal_log]: print signal logs on stderr\n"
@@ -150,6 +169,9 @@ static void print_usage(int argc, char *argv[])
     "\t[--topo_keep_best]: keep best peers, not random subset\n"
     "\t[--topo_add_best]: add best peers among desired ones, not random subset\n"
     "\t[--autotune_period]: automatically tune output bandwidth, 1:on, 0:off\n"
+#ifdef THREADS
+    "\t[--chunk_decoders <threads>]: decode received chunks on <threads> worker threads, 0:off\n"
+#endif
     "\t[--xloptimization]: pass a shortest-path file for cross layer optimization\n"
     "\n"
     "Special Source Peer options\n"
@@ -228,6 +250,10 @@ static void cmdline_parse(int argc, char *argv[])
         {"chunk_log", no_argument, 0, 0},
         {"neighbourhood_log", no_argument, 0, 0},
         {"push_strategy", no_argument, 0, 0},
+        {"edf_scheduling", no_argument, 0, 0},
+        {"prio_scheduling", no_argument, 0, 0},
+        {"urgent_requests", no_argument, 0, 0},
+        {"selective_offers", no_argument, 0, 0},
         {"chunk_loss_interval", required_argument, 0, 0},
         {"measure_start", required_argument, 0, 0},
         {"measure_every", required_argument, 0, 0},
@@ -242,6 +268,9 @@ static void cmdline_parse(int argc, char *argv[])
         {"topo_keep_best", no_argument, 0, 0},
         {"topo_add_best", no_argument, 0, 0},
         {"autotune_period", required_argument, 0, 0},
+#ifdef THREADS
+        {"chunk_decoders", required_argument, 0, 0},
+#endif
         {"xloptimization", required_argument, 0, 0},
 	{0, 0, 0, 0}
   };
@@ -253,6 +282,10 @@ static void cmdline_parse(int argc, char *argv[])
         if( strcmp( "neighbourhood_log", long_options[option_index].name ) == 0 ) { neigh_log = true; }
         if( strcmp( "signal_log", long_options[option_index].name ) == 0 ) { signal_log = true; }
         if( strcmp( "push_strategy", long_options[option_index].name ) == 0 ) { push_strategy = true; }
+        else if( strcmp( "edf_scheduling", long_options[option_index].name ) == 0 ) { edf_scheduling = true; }
+        else if( strcmp( "prio_scheduling", long_options[option_index].name ) == 0 ) { prio_scheduling = true; }
+        else if( strcmp( "urgent_requests", long_options[option_index].name ) == 0 ) { urgent_requests = true; }
+        else if( strcmp( "selective_offers", long_options[option_index].name ) == 0 ) { selective_offers = true; }
         if( strcmp( "chunk_loss_interval", long_options[option_index].name ) == 0 ) { chunk_loss_interval = atoi(optarg); }
 #ifndef MONL
         if( strcmp( "measure_start", long_options[option_index].name ) == 0 ) { tstartdiff.tv_sec = atoi(optarg); }
@@ -269,6 +302,9 @@ static void cmdline_parse(int argc, char *argv[])
         else if( strcmp( "topo_keep_best", long_options[option_index].name ) == 0 ) { topo_keep_best = true; }
         else if( strcmp( "topo_add_best", long_options[option_index].name ) == 0 ) { topo_add_best = true; }
         else if( strcmp( "autotune_period", long_options[option_index].name ) == 0 ) { autotune_period = (bool) atoi(optarg); }
+#ifdef THREADS
+        else if( strcmp( "chunk_decoders", long_options[option_index].name ) == 0 ) { chunk_decoders = atoi(optarg); }
+#endif
         else if( strcmp( "xloptimization", long_options[option_index].name ) == 0 ) { xloptimization = strdup((const char *) optarg); }
         break;
       case 'a':
@@ -352,12 +388,15 @@ static void cmdline_parse(int argc, char *argv[])
 	    exit(0);
       case 'x':
         chunk_test_port = atoi(optarg);
+        chunk_test = true;
         break;
       case 'y':
         chunk_test_ip = strdup(optarg);
+        chunk_test = true;
         break;
       case 'z':
         chunk_test_mtu = atoi(optarg);
+        chunk_test = true;
         break;
       default:
         fprintf(stderr, "Error: unknown option %c\n", o);
@@ -490,6 +529,8 @@ int main(int argc, char *argv[])
   (void) signal(SIGINT,leave);
 
   cmdline_parse(argc, argv);
+  // at most this many chunks are alive at once: keep about that much memory idle
+  chunk_pool_init((size_t) (buff_size + outbuff_size) * CHUNK_SIZE_TYPICAL);
 
   my_sock = init();
   if (my_sock == NULL) {
@@ -500,7 +541,7 @@ int main(int argc, char *argv[])
     fprintf(stderr, "Hi, I play the generic peer role\n");
     struct nodeID *srv;
 
-    if (chunk_test_init(chunk_test_port, chunk_test_ip, chunk_test_mtu)) {
+    if (chunk_test && chunk_test_init(chunk_test_port, chunk_test_ip, chunk_test_mtu)) {
       fprintf(stderr, "Cannot initialize chunk test: %s:%d\n", chunk_test_ip, chunk_test_port);
       return -1;
     }
@@ -52,8 +52,15 @@
 #include "topology.h"
 #include "measures.h"
 #include "scheduling.h"
+#include "sched_matrix.h"
+#include "timer_heap.h"
 #include "transaction.h"
 #include "node_addr.h"
+#include "chunk_pool.h"
+#include "loop_clock.h"
+#ifdef NH_EXT
+#include "net_helper_ext.h"
+#endif
 
 #include "scheduler_la.h"
 
@@ -62,6 +69,7 @@ uint64_t CB_SIZE_TIME = CB_SIZE_TIME_UNLIMITED;	//in millisec, defaults to unlim
 
 static bool heuristics_distance_maxdeliver = false;
 static int bcast_after_receive_every = 0;
+static int bcast_cnt;	// chunks received, for bcast_after_receive_every
 static bool neigh_on_chunk_recv = false;
 static bool send_bmap_before_push = false;
 
@@ -71,9 +79,48 @@ struct chunk_attributes {
   uint16_t hopcount;
 } __attribute__((packed));
 
+/*
+ * Aligned copy of the attributes of the chunks we hold, validated once when
+ * the chunk enters the buffer and indexed by chunk id, so that scoring and
+ * hopcount accounting need neither the chunk buffer nor the packed wire
+ * block. The wire block stays authoritative for what we send.
+ */
+struct chunk_meta {
+  int id;	// -1 if the slot is empty
+  int16_t hopcount;	// -1 if the chunk came with a malformed attributes block
+  uint8_t priority;	// chunker priority, e.g. higher for keyframes
+  uint16_t deadline_increment;
+  uint64_t deadline;
+};
+
+static struct chunk_meta *chunk_metas;
+static uint32_t chunk_metas_mask;
+
+static void chunk_metas_init(int size);
+static struct chunk_meta *chunk_meta_record(const struct chunk *c);
+
+/*
+ * Earliest-deadline-first mode: chunks are kept in a heap ordered by their
+ * logical deadline. Entries are never updated in place; a deadline change
+ * pushes a new entry and the old one is recognised as stale when popped.
+ */
+#define EDF_SCAN_MAX 32	// heap entries examined per push
+
+static struct timer_heap *edf_heap;
+
+static void edf_track(const struct chunk_meta *m);
+static bool edf_feasible(const struct chunk *c, const struct peer *p);
+
+static void chunk_request_urgent(int cid);
+static void chunk_lock_expired(int cid, const struct nodeID *owner);
+
 extern bool chunk_log;
 extern bool signal_log;
 extern bool push_strategy;
+extern bool edf_scheduling;
+extern bool prio_scheduling;
+extern bool urgent_requests;
+extern bool selective_offers;
 extern unsigned int chunk_loss_interval;
 extern int chunks_per_offer;
 
@@ -81,9 +128,16 @@ struct chunk_buffer *cb;
 static struct input_desc *input;
 static int cb_size;
 
+static struct chunkID_set *local_bmap;	//buffermap of cb, updated on insert and eviction
+static bool local_bmap_stale = true;
+
 static int offer_per_tick = 1;	//N_p parameter of POLITO
 
-int _needs(struct chunkID_set *cset, int cb_size, int cid);
+#define CHUNK_PRIORITY_DEFAULT 1	// chunks without chunker attributes
+#define REQUEST_MAX_DELIVER 8	// chunks sent in answer to a single request, whatever it asks
+static int prio_offered = -1;	// newest high-priority chunk offered around so far
+
+int _needs(const struct chunkID_set *cset, int cb_size, int cid);
 
 uint64_t gettimeofday_in_us(void)
 {
@@ -126,9 +180,20 @@ void stream_init(int size, struct nodeID *myID)
   static char conf[32];
 
   cb_size = size;
+  chunk_metas_init(cb_size);
+  chunk_locks_init(cb_size);
+  if (edf_scheduling) {
+    edf_heap = timer_heap_new(cb_size);
+  }
+  if (urgent_requests) {
+    output_set_gap_cb(chunk_request_urgent);
+    chunk_lock_set_timeout_cb(chunk_lock_expired);
+  }
 
   sprintf(conf, "size=%d", cb_size);
   cb = cb_init(conf);
+  local_bmap = chunkID_set_init("type=bitmap");
+  local_bmap_stale = true;
   chunkDeliveryInit(myID);
   chunkSignalingInit(myID);
   init_measures();
@@ -148,7 +213,7 @@ int source_init(const char *fname, struct nodeID *myID, int *fds, int fds_size,
 void chunk_attributes_fill(struct chunk* c)
 {
   struct chunk_attributes * ca;
-  int priority = 1;
+  int priority = CHUNK_PRIORITY_DEFAULT;
 
   assert((!c->attributes && c->attributes_size == 0)
 #ifdef CHUNK_ATTRIB_CHUNKER
@@ -166,69 +231,190 @@ void chunk_attributes_fill(struct chunk* c)
 #endif
 
   c->attributes_size = sizeof(struct chunk_attributes);
-  c->attributes = ca = malloc(c->attributes_size);
+  c->attributes = ca = malloc(c->attributes_size);	// the chunk buffer releases it with free()
 
   ca->deadline = c->id;
-  ca->deadline_increment = priority * 2;
+  ca->deadline_increment = priority * 2;	// the priority travels encoded here
   ca->hopcount = 0;
 }
 
-int chunk_get_hopcount(const struct chunk* c) {
-  struct chunk_attributes * ca;
-
+static struct chunk_attributes *chunk_attributes_get(const struct chunk *c)
+{
   if (!c->attributes || c->attributes_size != sizeof(struct chunk_attributes)) {
+    return NULL;
+  }
+
+  return (struct chunk_attributes *) c->attributes;
+}
+
+static struct chunk_meta *chunk_meta_get(int id)
+{
+  struct chunk_meta *m = &chunk_metas[id & chunk_metas_mask];
+
+  return m->id == id ? m : NULL;
+}
+
+// the only place where a chunk's attributes block is validated
+static struct chunk_meta *chunk_meta_record(const struct chunk *c)
+{
+  struct chunk_meta *m = &chunk_metas[c->id & chunk_metas_mask];
+  const struct chunk_attributes *ca = chunk_attributes_get(c);
+
+  m->id = c->id;
+  if (ca) {
+    m->hopcount = ca->hopcount;
+    m->priority = ca->deadline_increment / 2;
+    m->deadline_increment = ca->deadline_increment;
+    m->deadline = ca->deadline;
+  } else {
     fprintf(stderr,"Warning, chunk %d with strange attributes block. Size:%d expected:%lu\n", c->id, c->attributes ? c->attributes_size : 0, sizeof(struct chunk_attributes));
-    return -1;
+    m->hopcount = -1;
+    m->priority = CHUNK_PRIORITY_DEFAULT;
+    m->deadline_increment = 0;
+    m->deadline = 0;
   }
 
-  ca = (struct chunk_attributes *) c->attributes;
-  return ca->hopcount;
+  return m;
+}
+
+static void chunk_metas_init(int size)
+{
+  uint32_t n = 64, i;
+
+  while (n < 2 * (uint32_t) size) {	// room for ids spread over the buffer window
+    n <<= 1;
+  }
+  free(chunk_metas);
+  chunk_metas = malloc(n * sizeof(struct chunk_meta));
+  if (!chunk_metas) {
+    fprintf(stderr, "Memory allocation error!\n");
+    exit(-1);
+  }
+  for (i = 0; i < n; i++) {
+    chunk_metas[i].id = -1;
+  }
+  chunk_metas_mask = n - 1;
+}
+
+int chunk_get_hopcount(const struct chunk* c) {
+  const struct chunk_meta *m = chunk_meta_get(c->id);
+  const struct chunk_attributes *ca;
+
+  if (m) {
+    return m->hopcount;
+  }
+  ca = chunk_attributes_get(c);	// a chunk we do not hold, e.g. rejected as too old
+
+  return ca ? ca->hopcount : -1;
 }
 
-void chunk_attributes_update_received(struct chunk* c)
+static int chunk_priority(int cid)
+{
+  const struct chunk_meta *m = chunk_meta_get(cid);
+
+  return m ? m->priority : CHUNK_PRIORITY_DEFAULT;
+}
+
+// the wire block only: the chunk_meta is recorded once the chunk buffer took the chunk
+// returns the updated hopcount, -1 if the attributes block is malformed
+int chunk_attributes_update_received(struct chunk* c)
 {
   struct chunk_attributes * ca;
 
-  if (!c->attributes || c->attributes_size != sizeof(struct chunk_attributes)) {
-    fprintf(stderr,"Warning, received chunk %d with strange attributes block. Size:%d expected:%lu\n", c->id, c->attributes ? c->attributes_size : 0, sizeof(struct chunk_attributes));
-    return;
+  ca = chunk_attributes_get(c);
+  if (!ca) {
+    return -1;
   }
 
-  ca = (struct chunk_attributes *) c->attributes;
   ca->hopcount++;
   dprintf("Received chunk %d with hopcount %hu\n", c->id, ca->hopcount);
+
+  return ca->hopcount;
 }
 
 void chunk_attributes_update_sending(const struct chunk* c)
 {
   struct chunk_attributes * ca;
+  struct chunk_meta *m;
 
-  if (!c->attributes || c->attributes_size != sizeof(struct chunk_attributes)) {
-    fprintf(stderr,"Warning, chunk %d with strange attributes block\n", c->id);
+  m = chunk_meta_get(c->id);
+  if (!m) {	// slot taken over by a much newer chunk: leave its meta alone
+    ca = chunk_attributes_get(c);
+    if (ca) {
+      ca->deadline += ca->deadline_increment;
+    }
+    return;
+  }
+  if (m->hopcount < 0) {
     return;
   }
 
   ca = (struct chunk_attributes *) c->attributes;
-  ca->deadline += ca->deadline_increment;
-  dprintf("Sending chunk %d with deadline %lu (increment: %d)\n", c->id, ca->deadline, ca->deadline_increment);
+  m->deadline += m->deadline_increment;
+  ca->deadline = m->deadline;
+  edf_track(m);
+  dprintf("Sending chunk %d with deadline %lu (increment: %d)\n", c->id, m->deadline, m->deadline_increment);
 }
 
-struct chunkID_set *cb_to_bmap(struct chunk_buffer *chbuf)
+static void local_bmap_rebuild(void)
 {
   struct chunk *chunks;
   int num_chunks, i;
-  struct chunkID_set *my_bmap = chunkID_set_init("type=bitmap");
-  chunks = cb_get_chunks(chbuf, &num_chunks);
 
+  chunkID_set_clear(local_bmap, 0);
+  chunks = cb_get_chunks(cb, &num_chunks);
   for(i=num_chunks-1; i>=0; i--) {
-    chunkID_set_add_chunk(my_bmap, chunks[i].id);
+    chunkID_set_add_chunk(local_bmap, chunks[i].id);
   }
-  return my_bmap;
+  local_bmap_stale = false;
 }
 
-// a simple implementation that request everything that we miss ... up to max deliver
+/*
+ * Keep the local buffermap in sync after a cb_add_chunk() returning res.
+ * The chunk buffer only ever evicts its oldest chunks, so the evicted IDs
+ * are the ones in the bmap below the earliest chunk left in the buffer:
+ * with a full buffer that is one removal per insert.
+ */
+static void local_bmap_update(int chunkid, int res)
+{
+  struct chunk *chunks;
+  int num_chunks, earliest;
+
+  if (res < 0 || local_bmap_stale) return;
+
+  chunks = cb_get_chunks(cb, &num_chunks);
+  while (num_chunks && chunkID_set_size(local_bmap) &&
+         (earliest = chunkID_set_get_earliest(local_bmap)) < chunks[0].id) {
+    if (chunkID_set_remove_chunk(local_bmap, earliest) < 0) {
+      local_bmap_stale = true;	// rebuilt on the next read
+      return;
+    }
+  }
+  chunkID_set_add_chunk(local_bmap, chunkid);
+}
+
+/*
+ * Read-only view of our buffermap for the signalling paths.
+ * The returned set is owned by the streaming module: do not modify or free it,
+ * and do not keep it across calls adding chunks to the buffer.
+ */
+const struct chunkID_set *cb_bmap_snapshot(void)
+{
+  if (local_bmap_stale) {
+    local_bmap_rebuild();
+  }
+  return local_bmap;
+}
+
+/*
+ * a simple implementation that request everything that we miss ... up to max deliver
+ * Chunks are taken in the order of the offer: with --prio_scheduling the
+ * sender lists its high-priority chunks first, so these are the ones
+ * accepted when max_deliver cuts the list short.
+ */
 struct chunkID_set *get_chunks_to_accept(const struct nodeID *fromid, const struct chunkID_set *cset_off, int max_deliver, uint16_t trans_id){
-  struct chunkID_set *cset_acc, *my_bmap;
+  struct chunkID_set *cset_acc;
+  const struct chunkID_set *my_bmap;
   int i, d, cset_off_size;
   //double lossrate;
   struct peer *from = nodeid_to_peer(fromid, 0);
@@ -239,14 +425,14 @@ struct chunkID_set *get_chunks_to_accept(const struct nodeID *fromid, const stru
   //lossrate = get_lossrate_receive(from->id);
   //lossrate = finite(lossrate) ? lossrate : 0;	//start agressively, assuming 0 loss
   //if (rand()/((double)RAND_MAX + 1) >= 10 * lossrate ) {
-    my_bmap = cb_to_bmap(cb);
+    my_bmap = cb_bmap_snapshot();
     cset_off_size = chunkID_set_size(cset_off);
     for (i = 0, d = 0; i < cset_off_size && d < max_deliver; i++) {
       int chunkid = chunkID_set_get_chunk(cset_off, i);
       //dprintf("\tdo I need c%d ? :",chunkid);
-      if (!chunk_islocked(chunkid) && _needs(my_bmap, cb_size, chunkid)) {
+      if (!chunk_islocked(chunkid) && _needs(my_bmap, cb_size, chunkid) &&
+          chunk_lock(chunkid,from) == 0) {
         chunkID_set_add_chunk(cset_acc, chunkid);
-        chunk_lock(chunkid,from);
         dtprintf("accepting %d from %s", chunkid, node_addr_tr(fromid));
 #ifdef MONL
         dprintf(", loss:%f rtt:%f", get_lossrate(fromid), get_rtt(fromid));
@@ -255,7 +441,6 @@ struct chunkID_set *get_chunks_to_accept(const struct nodeID *fromid, const stru
         d++;
       }
     }
-    chunkID_set_free(my_bmap);
   //} else {
   //    dtprintf("accepting -- from %s loss:%f rtt:%f\n", node_addr_tr(fromid), lossrate, get_rtt(fromid));
   //}
@@ -267,10 +452,9 @@ struct chunkID_set *get_chunks_to_accept(const struct nodeID *fromid, const stru
 
 void send_bmap(const struct nodeID *toid)
 {
-  struct chunkID_set *my_bmap = cb_to_bmap(cb);
+  const struct chunkID_set *my_bmap = cb_bmap_snapshot();
    sendBufferMap(toid,NULL, my_bmap, input ? 0 : cb_size, 0);
 	 if (signal_log) log_signal(get_my_addr(),toid,chunkID_set_size(my_bmap),0,sig_send_buffermap,"SENT");
-  chunkID_set_free(my_bmap);
 }
 
 void bcast_bmap()
@@ -278,26 +462,24 @@ void bcast_bmap()
   int i, n;
   struct peer **neighbours;
   struct peerset *pset;
-  struct chunkID_set *my_bmap;
+  const struct chunkID_set *my_bmap;
 
   pset = topology_get_neighbours();
   n = peerset_size(pset);
   neighbours = peerset_get_peers(pset);
 
-  my_bmap = cb_to_bmap(cb);	//cache our bmap for faster processing
+  my_bmap = cb_bmap_snapshot();
   for (i = 0; i<n; i++) {
     sendBufferMap(neighbours[i]->id,NULL, my_bmap, input ? 0 : cb_size, 0);
 	 	if (signal_log) log_signal(get_my_addr(),neighbours[i]->id,chunkID_set_size(my_bmap),0,sig_send_buffermap,"SENT");
   }
-  chunkID_set_free(my_bmap);
 }
 
 void send_ack(struct nodeID *toid, uint16_t trans_id)
 {
-  struct chunkID_set *my_bmap = cb_to_bmap(cb);
+  const struct chunkID_set *my_bmap = cb_bmap_snapshot();
   sendAck(toid, my_bmap,trans_id);
 	if (signal_log) log_signal(get_my_addr(),toid,chunkID_set_size(my_bmap),trans_id,sig_ack,"SENT");
-  chunkID_set_free(my_bmap);
 }
 
 double get_average_lossrate_pset(struct peerset *pset)
@@ -329,47 +511,73 @@ void ack_chunk(struct chunk *c, struct nodeID *from, uint16_t trans_id)
   send_ack(from, trans_id);	//send explicit ack
 }
 
-void received_chunk(struct nodeID *from, const uint8_t *buff, int len)
+/*
+ * Chunk reception is split in two so that decoding can run on any thread:
+ * chunk_decode() only touches the caller's buffer and chunk, while
+ * chunk_received() updates the protocol state and must run on its owner.
+ */
+int chunk_decode(const uint8_t *buff, int len, struct chunk *c, uint16_t *transid)
 {
   int res;
-  static struct chunk c;
+
+  res = parseChunkMsg(buff + 1, len - 1, c, transid);
+  if (res <= 0) {
+    return -1;
+  }
+  if (chunk_loss_interval && c->id % chunk_loss_interval == 0) {
+    fprintf(stderr,"[NOISE] Chunk %d discarded >:)\n",c->id);
+    free(c->data);
+    free(c->attributes);
+    return 0;
+  }
+
+  return 1;
+}
+
+void chunk_received(struct nodeID *from, struct chunk *c, uint16_t transid)
+{
+  int res, hopcount;
   struct peer *p;
-  static int bcast_cnt;
+
+  hopcount = chunk_attributes_update_received(c);
+  chunk_unlock(c->id);
+  dprintf("Received chunk %d from peer: %s\n", c->id, node_addr_tr(from));
+  if(chunk_log) log_chunk(from,get_my_addr(),c,"RECEIVED");
+//{fprintf(stderr, "TEO: Peer %s received chunk %d from peer: %s at: %"PRIu64" hopcount: %i Size: %d bytes\n", node_addr_tr(get_my_addr()),c->id, node_addr_tr(from), gettimeofday_in_us(), chunk_get_hopcount(c), c->size);}
+  output_deliver(c);
+  res = cb_add_chunk(cb, c);
+  local_bmap_update(c->id, res);
+  reg_chunk_receive(c->id, c->timestamp, hopcount, res==E_CB_OLD, res==E_CB_DUPLICATE);
+  cb_print();
+  if (res >= 0) {
+    edf_track(chunk_meta_record(c));
+  } else {
+    dprintf("\tchunk too old, buffer full with newer chunks\n");
+    if(chunk_log) log_chunk_error(from,get_my_addr(),c,res); //{fprintf(stderr, "TEO: Received chunk: %d too old (buffer full with newer chunks) from peer: %s at: %"PRIu64"\n", c->id, node_addr_tr(from), gettimeofday_in_us());}
+    free(c->data);
+    free(c->attributes);
+  }
+  p = nodeid_to_peer(from, neigh_on_chunk_recv);
+  if (p) {	//now we have it almost sure
+    chunkID_set_add_chunk(p->bmap,c->id);	//don't send it back
+    gettimeofday(&p->bmap_timestamp, NULL);
+  }
+  ack_chunk(c, from, transid);	//send explicit ack
+  if (bcast_after_receive_every && bcast_cnt++ % bcast_after_receive_every == 0) {
+     bcast_bmap();
+  }
+}
+
+void received_chunk(struct nodeID *from, const uint8_t *buff, int len)
+{
+  struct chunk c;
   uint16_t transid;
+  int res;
 
-  res = parseChunkMsg(buff + 1, len - 1, &c, &transid);
+  res = chunk_decode(buff, len, &c, &transid);
   if (res > 0) {
-		if (chunk_loss_interval && c.id % chunk_loss_interval == 0) {
-			fprintf(stderr,"[NOISE] Chunk %d discarded >:)\n",c.id);
-			free(c.data);
-			free(c.attributes);
-			return;
-		}
-    chunk_attributes_update_received(&c);
-    chunk_unlock(c.id);
-    dprintf("Received chunk %d from peer: %s\n", c.id, node_addr_tr(from));
-    if(chunk_log) log_chunk(from,get_my_addr(),&c,"RECEIVED");
-//{fprintf(stderr, "TEO: Peer %s received chunk %d from peer: %s at: %"PRIu64" hopcount: %i Size: %d bytes\n", node_addr_tr(get_my_addr()),c.id, node_addr_tr(from), gettimeofday_in_us(), chunk_get_hopcount(&c), c.size);}
-    output_deliver(&c);
-    res = cb_add_chunk(cb, &c);
-    reg_chunk_receive(c.id, c.timestamp, chunk_get_hopcount(&c), res==E_CB_OLD, res==E_CB_DUPLICATE);
-    cb_print();
-    if (res < 0) {
-      dprintf("\tchunk too old, buffer full with newer chunks\n");
-      if(chunk_log) log_chunk_error(from,get_my_addr(),&c,res); //{fprintf(stderr, "TEO: Received chunk: %d too old (buffer full with newer chunks) from peer: %s at: %"PRIu64"\n", c.id, node_addr_tr(from), gettimeofday_in_us());}
-      free(c.data);
-      free(c.attributes);
-    }
-    p = nodeid_to_peer(from, neigh_on_chunk_recv);
-    if (p) {	//now we have it almost sure
-      chunkID_set_add_chunk(p->bmap,c.id);	//don't send it back
-      gettimeofday(&p->bmap_timestamp, NULL);
-    }
-    ack_chunk(&c, from, transid);	//send explicit ack
-    if (bcast_after_receive_every && bcast_cnt % bcast_after_receive_every == 0) {
-       bcast_bmap();
-    }
-  } else {
+    chunk_received(from, &c, transid);
+  } else if (res < 0) {
     fprintf(stderr,"\tError: can't decode chunk!\n");
   }
 }
@@ -378,7 +586,7 @@ struct chunk *generated_chunk(suseconds_t *delta)
 {
   struct chunk *c;
 
-  c = malloc(sizeof(struct chunk));
+  c = chunk_pool_alloc(sizeof(struct chunk));
   if (!c) {
     fprintf(stderr, "Memory allocation error!\n");
     return NULL;
@@ -390,7 +598,7 @@ struct chunk *generated_chunk(suseconds_t *delta)
     exit(-1);
   }
   if (c->data == NULL) {
-    free(c);
+    chunk_pool_free(c, sizeof(struct chunk));
     return NULL;
   }
   dprintf("Generated chunk %d of %d bytes\n",c->id, c->size);
@@ -403,12 +611,14 @@ int add_chunk(struct chunk *c)
   int res;
 
   res = cb_add_chunk(cb, c);
+  local_bmap_update(c->id, res);
   if (res < 0) {
     free(c->data);
     free(c->attributes);
-    free(c);
+    chunk_pool_free(c, sizeof(struct chunk));
     return 0;
   }
+  edf_track(chunk_meta_record(c));
  // free(c);
   return 1;
 }
@@ -447,7 +657,7 @@ int needs(struct peer *n, int cid){
   if (CB_SIZE_TIME < CB_SIZE_TIME_UNLIMITED) {
     uint64_t ts;
     ts = get_chunk_timestamp(cid);
-    if (ts && (ts < gettimeofday_in_us() - CB_SIZE_TIME)) {	//if we don't know the timestamp, we accept
+    if (ts && (ts < loop_wallclock_us() - CB_SIZE_TIME)) {	//if we don't know the timestamp, we accept
       return 0;
     }
   }
@@ -464,6 +674,21 @@ int needs(struct peer *n, int cid){
   return _needs(p->bmap, p->cb_size, cid);
 }
 
+// chunks older than the playout limit are not worth sending
+static int chunk_fresh(int cid)
+{
+  uint64_t ts;
+
+  if (CB_SIZE_TIME < CB_SIZE_TIME_UNLIMITED) {
+    ts = get_chunk_timestamp(cid);
+    if (ts && (ts < loop_wallclock_us() - CB_SIZE_TIME)) {	//if we don't know the timestamp, we accept
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 /**
  * Function checking if chunkID_set cset may need chunk with id cid
  * @cset: target cset
@@ -471,7 +696,7 @@ int needs(struct peer *n, int cid){
  * 	the maximum capacity in of the receiving peer (so it's 0 for the source)
  * @cid: target chunk identifier
  */
-int _needs(struct chunkID_set *cset, int cb_size, int cid){
+int _needs(const struct chunkID_set *cset, int cb_size, int cid){
 
   if (cb_size == 0) { //if it declared it does not needs chunks
     return 0;
@@ -480,7 +705,7 @@ int _needs(struct chunkID_set *cset, int cb_size, int cid){
   if (CB_SIZE_TIME < CB_SIZE_TIME_UNLIMITED) {
     uint64_t ts;
     ts = get_chunk_timestamp(cid);
-    if (ts && (ts < gettimeofday_in_us() - CB_SIZE_TIME)) {	//if we don't know the timestamp, we accept
+    if (ts && (ts < loop_wallclock_us() - CB_SIZE_TIME)) {	//if we don't know the timestamp, we accept
       return 0;
     }
   }
@@ -552,19 +777,17 @@ double chunkScoreChunkID(int *cid){
 }
 
 uint64_t get_chunk_deadline(int cid){
-  const struct chunk_attributes * ca;
+  const struct chunk_meta *m = chunk_meta_get(cid);
+  const struct chunk_attributes *ca;
   const struct chunk *c;
 
-  c = cb_get_chunk(cb, cid);
-  if (!c) return 0;
-
-  if (!c->attributes || c->attributes_size != sizeof(struct chunk_attributes)) {
-    fprintf(stderr,"Warning, chunk %d with strange attributes block\n", c->id);
-    return 0;
+  if (m) {
+    return m->deadline;
   }
+  c = cb_get_chunk(cb, cid);	// slot taken over by a much newer chunk
+  ca = c ? chunk_attributes_get(c) : NULL;
 
-  ca = (struct chunk_attributes *) c->attributes;
-  return ca->deadline;
+  return ca ? ca->deadline : 0;
 }
 
 double chunkScoreDL(int *cid){
@@ -575,6 +798,30 @@ double chunkScoreTimestamp(int *cid){
   return (double) get_chunk_timestamp(*cid);
 }
 
+static int edf_cmp(const void *a, const void *b)
+{
+  uint64_t da = get_chunk_deadline(*(const int *) a);
+  uint64_t db = get_chunk_deadline(*(const int *) b);
+
+  return da < db ? -1 : da > db;
+}
+
+// higher priority first, then earliest deadline or oldest chunk
+static int prio_cmp(const void *a, const void *b)
+{
+  int pa = chunk_priority(*(const int *) a);
+  int pb = chunk_priority(*(const int *) b);
+
+  if (pa != pb) {
+    return pb - pa;
+  }
+  if (edf_scheduling) {
+    return edf_cmp(a, b);
+  }
+
+  return *(const int *) a - *(const int *) b;
+}
+
 void send_accepted_chunks(const struct nodeID *toid, struct chunkID_set *cset_acc, int max_deliver, uint16_t trans_id){
   int i, d, cset_acc_size, res;
   struct peer *to = nodeid_to_peer(toid, 0);
@@ -583,26 +830,77 @@ void send_accepted_chunks(const struct nodeID *toid, struct chunkID_set *cset_ac
 
   cset_acc_size = chunkID_set_size(cset_acc);
   reg_offer_accept_out(cset_acc_size > 0 ? 1 : 0);	//this only works if accepts are sent back even if 0 is accepted
-  for (i = 0, d=0; i < cset_acc_size && d < max_deliver; i++) {
+  {
+    int chunkids[cset_acc_size];
+    for (i = 0; i < cset_acc_size; i++) {
+      chunkids[i] = chunkID_set_get_chunk(cset_acc, i);
+    }
+    if (prio_scheduling) {
+      qsort(chunkids, cset_acc_size, sizeof(int), prio_cmp);
+    } else if (edf_scheduling) {
+      qsort(chunkids, cset_acc_size, sizeof(int), edf_cmp);
+    }
+    for (i = 0, d=0; i < cset_acc_size && d < max_deliver; i++) {
+      const struct chunk *c;
+      int chunkid = chunkids[i];
+      c = cb_get_chunk(cb, chunkid);
+      if (!c) {	// we should have the chunk
+        dprintf("%s asked for chunk %d we do not own anymore\n", node_addr_tr(toid), chunkid);
+        continue;
+      }
+      if (!to || needs(to, chunkid)) {	//he should not have it. Although the "accept" should have been an answer to our "offer", we do some verification
+        if (edf_scheduling && to && !edf_feasible(c, to)) {
+          dprintf("chunk %d cannot reach %s in time, skipped\n", chunkid, node_addr_tr(toid));
+          reg_deadline_miss(true);
+          continue;
+        }
+        chunk_attributes_update_sending(c);
+        res = sendChunk(toid, c, trans_id);
+        if (res >= 0) {
+          if(to) chunkID_set_add_chunk(to->bmap, c->id); //don't send twice ... assuming that it will actually arrive
+          d++;
+          reg_chunk_send(c->id);
+          if (edf_scheduling) reg_deadline_miss(false);
+        	if(chunk_log) log_chunk(get_my_addr(),toid,c,"SENT_ACCEPTED");
+          //{fprintf(stderr, "TEO: Sending chunk %d to peer: %s at: %"PRIu64" Result: %d Size: %d bytes\n", c->id, node_addr_tr(toid), gettimeofday_in_us(), res, c->size);}
+        } else {
+          fprintf(stderr,"ERROR sending chunk %d\n",c->id);
+        }
+      }
+    }
+  }
+}
+
+// answer a pull: no transaction of ours, the ack comes back with the requester's id
+void send_requested_chunks(const struct nodeID *toid, const struct chunkID_set *cset_req, int max_deliver, uint16_t trans_id){
+  int i, d, cset_req_size, res;
+  struct peer *to = nodeid_to_peer(toid, 0);
+
+  if (!to) {	// only neighbours get chunks pulled
+    dprintf("Ignoring a chunk request from %s, not a neighbour\n", node_addr_tr(toid));
+    return;
+  }
+  if (max_deliver > REQUEST_MAX_DELIVER) {
+    max_deliver = REQUEST_MAX_DELIVER;
+  }
+  cset_req_size = chunkID_set_size(cset_req);
+  for (i = 0, d = 0; i < cset_req_size && d < max_deliver; i++) {
     const struct chunk *c;
-    int chunkid = chunkID_set_get_chunk(cset_acc, i);
+    int chunkid = chunkID_set_get_chunk(cset_req, i);
     c = cb_get_chunk(cb, chunkid);
-    if (!c) {	// we should have the chunk
-      dprintf("%s asked for chunk %d we do not own anymore\n", node_addr_tr(toid), chunkid);
+    if (!c) {
+      dprintf("%s requested chunk %d we do not own\n", node_addr_tr(toid), chunkid);
       continue;
     }
-    if (!to || needs(to, chunkid)) {	//he should not have it. Although the "accept" should have been an answer to our "offer", we do some verification
-      chunk_attributes_update_sending(c);
-      res = sendChunk(toid, c, trans_id);
-      if (res >= 0) {
-        if(to) chunkID_set_add_chunk(to->bmap, c->id); //don't send twice ... assuming that it will actually arrive
-        d++;
-        reg_chunk_send(c->id);
-      	if(chunk_log) log_chunk(get_my_addr(),toid,c,"SENT_ACCEPTED");
-        //{fprintf(stderr, "TEO: Sending chunk %d to peer: %s at: %"PRIu64" Result: %d Size: %d bytes\n", c->id, node_addr_tr(toid), gettimeofday_in_us(), res, c->size);}
-      } else {
-        fprintf(stderr,"ERROR sending chunk %d\n",c->id);
-      }
+    chunk_attributes_update_sending(c);
+    res = sendChunk(toid, c, trans_id);
+    if (res >= 0) {
+      chunkID_set_add_chunk(to->bmap, c->id);
+      d++;
+      reg_chunk_send(c->id);
+      if(chunk_log) log_chunk(get_my_addr(),toid,c,"SENT_REQUESTED");
+    } else {
+      fprintf(stderr,"ERROR sending chunk %d\n",c->id);
     }
   }
 }
@@ -640,12 +938,214 @@ static double get_rtt_of(struct nodeID* n){
 
 #define DEFAULT_RTT_ESTIMATE 0.5
 
-static struct chunkID_set *compose_offer_cset(struct peer *p)
+//get the offer-accept rtt, or the MONL rtt when available
+static double get_offer_accept_rtt_of(struct nodeID* n){
+#ifdef MONL
+  return get_rtt(n);
+#else
+  double rtt = get_offer_accept_rtt_measure(n);
+
+  return rtt >= 0 ? rtt : NAN;
+#endif
+}
+
+/*
+ * Pull a chunk from the neighbour advertising it with the lowest offer-accept
+ * RTT, other than exclude. The chunk gets locked to that neighbour, so that
+ * it is not asked again nor accepted from others until it arrives or the
+ * lock times out.
+ */
+static void chunk_request(int cid, const struct nodeID *exclude)
+{
+  struct peerset *pset = topology_get_neighbours();
+  struct peer **neighbours = peerset_get_peers(pset);
+  struct peer *best = NULL;
+  struct chunkID_set *cset;
+  double best_rtt = INFINITY;
+  int i, n = peerset_size(pset);
+
+  if (chunk_islocked(cid) || cb_get_chunk(cb, cid)) {	// on its way, or here already
+    return;
+  }
+  for (i = 0; i < n; i++) {
+    double rtt;
+
+    if (!neighbours[i]->bmap || chunkID_set_check(neighbours[i]->bmap, cid) < 0) {
+      continue;
+    }
+    if (exclude && nodeid_equal(neighbours[i]->id, exclude)) {
+      continue;
+    }
+    rtt = get_offer_accept_rtt_of(neighbours[i]->id);
+    if (isnan(rtt)) rtt = DEFAULT_RTT_ESTIMATE;
+    if (!best || rtt < best_rtt) {
+      best = neighbours[i];
+      best_rtt = rtt;
+    }
+  }
+  if (!best) {
+    dprintf("chunk %d is urgent, but no neighbour advertises it\n", cid);
+    return;
+  }
+
+  cset = chunkID_set_init("size=1");
+  chunkID_set_add_chunk(cset, cid);
+  dtprintf("requesting chunk %d from %s", cid, node_addr_tr(best->id));
+  dprintf(", rtt:%f\n", best_rtt);
+  if (chunk_lock(cid, best) == 0) {
+    requestChunks(best->id, cset, 1, 0);	//no transaction: it is acked like a push
+    if (signal_log) log_signal(get_my_addr(),best->id,1,0,sig_request,"SENT");
+  }
+  chunkID_set_free(cset);
+}
+
+// a chunk the output is about to skip
+static void chunk_request_urgent(int cid)
+{
+  chunk_request(cid, NULL);
+}
+
+// an accepted or requested chunk did not arrive: ask someone else if still useful
+static void chunk_lock_expired(int cid, const struct nodeID *owner)
 {
-  int num_chunks, j;
+  if (_needs(cb_bmap_snapshot(), cb_size, cid)) {
+    chunk_request(cid, owner);
+  }
+}
+
+static void edf_rebuild(void)
+{
+  int num_chunks, i;
+  struct chunk *chunks = cb_get_chunks(cb, &num_chunks);
+
+  timer_heap_destroy(&edf_heap);
+  edf_heap = timer_heap_new(cb_size);
+  for (i = 0; i < num_chunks; i++) {
+    const struct chunk_meta *m = chunk_meta_get(chunks[i].id);
+
+    if (m && m->hopcount >= 0) {
+      timer_heap_push(edf_heap, m->deadline, m->id);
+    }
+  }
+}
+
+static void edf_track(const struct chunk_meta *m)
+{
+  if (!edf_heap || !m || m->hopcount < 0) {
+    return;
+  }
+  if (timer_heap_length(edf_heap) >= 4 * (uint32_t) cb_size) {	// mostly stale entries by now
+    edf_rebuild();	// picks up m too, it is already in the buffer
+    return;
+  }
+  timer_heap_push(edf_heap, m->deadline, m->id);
+}
+
+/*
+ * Can chunk c still reach peer p before it leaves the playout window?
+ * With a time-limited buffer the window closes CB_SIZE_TIME after the chunk
+ * was generated; otherwise it closes when the buffer evicts it, that is
+ * after the stream time separating it from our oldest chunk. Half the RTT
+ * is what the chunk needs to get there.
+ */
+static bool edf_feasible(const struct chunk *c, const struct peer *p)
+{
+  double rtt = get_offer_accept_rtt_of(p->id);
+  uint64_t now, left = 0;
+
+  if (isnan(rtt)) rtt = DEFAULT_RTT_ESTIMATE;
+  if (CB_SIZE_TIME < CB_SIZE_TIME_UNLIMITED) {
+    if (!c->timestamp) {	//if we don't know the timestamp, we try
+      return true;
+    }
+    now = loop_wallclock_us();
+    if (c->timestamp + CB_SIZE_TIME > now) left = c->timestamp + CB_SIZE_TIME - now;
+  } else {
+    int num_chunks;
+    const struct chunk *chunks = cb_get_chunks(cb, &num_chunks);
+
+    if (num_chunks && c->timestamp > chunks[0].timestamp) left = c->timestamp - chunks[0].timestamp;
+  }
+
+  return left > rtt * 1e6 / 2;
+}
+
+/*
+ * EDF push: pop chunks in deadline order until one is found that some
+ * neighbour needs and can still receive in time. Chunks nobody needs right
+ * now go back to the heap once the scan is over, a neighbour might ask for
+ * them later. Those nobody can get in time (a deadline miss) are dropped.
+ * The chosen chunk is tracked again once its deadline is advanced by
+ * sending it.
+ */
+static size_t edf_select_push(struct peer **peers, int n, struct PeerChunk *pair)
+{
+  int kept[EDF_SCAN_MAX];
+  uint64_t kept_deadline[EDF_SCAN_MAX];
+  int scanned, nkept = 0;
+  size_t res = 0;
+
+  for (scanned = 0; scanned < EDF_SCAN_MAX && !res; scanned++) {
+    const struct chunk_meta *m;
+    const struct chunk *c;
+    struct peer *in_time[n];
+    struct peer *target[1];
+    size_t target_len = 1;
+    uint64_t deadline;
+    int cid, i, needy = 0, feasible = 0;
+
+    cid = timer_heap_pop(edf_heap, &deadline);
+    if (cid < 0) {
+      break;
+    }
+    m = chunk_meta_get(cid);
+    c = cb_get_chunk(cb, cid);
+    if (!m || m->deadline != deadline || !c) {	// superseded or evicted
+      continue;
+    }
+    for (i = 0; i < n; i++) {
+      if (needs(peers[i], cid)) {
+        needy++;
+        if (edf_feasible(c, peers[i])) in_time[feasible++] = peers[i];
+      }
+    }
+    if (!needy) {
+      kept[nkept] = cid;
+      kept_deadline[nkept++] = deadline;
+      continue;
+    }
+    if (!feasible) {
+      dprintf("chunk %d cannot reach any neighbour in time, skipped\n", cid);
+      reg_deadline_miss(true);
+      continue;
+    }
+    sched_matrix_build(in_time, feasible, &cid, 1, chunk_fresh);
+    sched_matrix_select_peers(SCHED_WEIGHTING, in_time, &cid, 1, target, &target_len, push_strategy ? peerWeightLoss : SCHED_PEER);
+    if (target_len) {
+      pair->peer = target[0];
+      pair->chunk = cid;
+      reg_deadline_miss(false);
+      res = 1;
+    } else {
+      kept[nkept] = cid;
+      kept_deadline[nkept++] = deadline;
+    }
+  }
+  while (nkept--) {
+    timer_heap_push(edf_heap, kept_deadline[nkept], kept[nkept]);
+  }
+
+  return res;
+}
+
+// selective: leave out what p's last buffermap says it has
+static struct chunkID_set *compose_offer_cset(struct peer *p, bool selective)
+{
+  int num_chunks, j, k;
   uint64_t smallest_ts; //, largest_ts;
   double dt;
-  struct chunkID_set *my_bmap = chunkID_set_init("type=bitmap");
+  // a bitmap loses the order, the default list keeps it for the receiver
+  struct chunkID_set *my_bmap = chunkID_set_init(prio_scheduling ? "size=0" : "type=bitmap");
   struct chunk *chunks = cb_get_chunks(cb, &num_chunks);
 
   if (p) {
@@ -665,7 +1165,16 @@ static struct chunkID_set *compose_offer_cset(struct peer *p)
   } else {
     j = num_chunks-1;
   }
+  if (prio_scheduling) {	//high-priority chunks first, then the others
+    for (k = j; k >= 0; k--) {
+      if (selective && p && !needs(p, chunks[k].id)) continue;
+      if (chunks[k].timestamp > smallest_ts + dt && chunk_priority(chunks[k].id) > CHUNK_PRIORITY_DEFAULT)
+      chunkID_set_add_chunk(my_bmap, chunks[k].id);
+    }
+  }
   for(; j>=0; j--) {
+    if (prio_scheduling && chunk_priority(chunks[j].id) > CHUNK_PRIORITY_DEFAULT) continue;
+    if (selective && p && !needs(p, chunks[j].id)) continue;	//it has it, as far as we know
     if (chunks[j].timestamp > smallest_ts + dt)
     chunkID_set_add_chunk(my_bmap, chunks[j].id);
   }
@@ -673,6 +1182,23 @@ static struct chunkID_set *compose_offer_cset(struct peer *p)
   return my_bmap;
 }
 
+// with --prio_scheduling, a fresh high-priority chunk is offered to twice the peers
+static int prio_offer_factor(const struct chunk *buff, int size)
+{
+  int i;
+
+  if (!prio_scheduling) {
+    return 1;
+  }
+  for (i = size - 1; i >= 0 && buff[i].id > prio_offered; i--) {
+    if (chunk_priority(buff[i].id) > CHUNK_PRIORITY_DEFAULT) {
+      prio_offered = buff[i].id;
+      return 2;
+    }
+  }
+
+  return 1;
+}
 
 void send_offer()
 {
@@ -686,11 +1212,17 @@ void send_offer()
   neighbours = peerset_get_peers(pset);
   dprintf("Send Offer: %d neighbours\n", n);
   if (n == 0) return;
+#ifdef NH_EXT
+  if (send_congested()) {	// the offers would be dropped, skip this tick
+    dprintf("Send Offer: net helper congested, skipping\n");
+    return;
+  }
+#endif
   buff = cb_get_chunks(cb, &size);
   if (size == 0) return;
 
   {
-    size_t selectedpeers_len = offer_peer_count();
+    size_t selectedpeers_len = offer_peer_count() * prio_offer_factor(buff, size);
     int chunkids[size];
     struct peer *nodeids[n];
     struct peer *selectedpeers[selectedpeers_len];
@@ -704,12 +1236,28 @@ void send_offer()
 
     for (i = 0;i < size; i++) chunkids[size - 1 - i] = (buff+i)->id;
     for (i = 0; i<n; i++) nodeids[i] = neighbours[i];
+#if SCHED_MATRIX
+    sched_matrix_build(nodeids, n, chunkids, size, chunk_fresh);
+    sched_matrix_select_peers(SCHED_WEIGHTING, nodeids, chunkids, size, selectedpeers, &selectedpeers_len, SCHED_PEER);
+#else
     selectPeersForChunks(SCHED_WEIGHTING, nodeids, n, chunkids, size, selectedpeers, &selectedpeers_len, SCHED_NEEDS, SCHED_PEER);
+#endif
 
     for (i=0; i<selectedpeers_len ; i++){
-      int transid = transaction_create(selectedpeers[i]->id);
+      int transid;
       int max_deliver = offer_max_deliver(selectedpeers[i]->id);
-      struct chunkID_set *offer_cset = compose_offer_cset(selectedpeers[i]);
+      // older peers would take the flag for a larger max_deliver, and a partial offer for a buffermap
+      bool selective = selective_offers && topology_peer_selective_offers(selectedpeers[i]->id);
+      struct chunkID_set *offer_cset = compose_offer_cset(selectedpeers[i], selective);
+      if (selective) {
+        if (chunkID_set_size(offer_cset) == 0) {	//nothing it misses is old enough to offer
+          chunkID_set_free(offer_cset);
+          continue;
+        }
+        if (max_deliver >= OFFER_SELECTIVE) max_deliver = OFFER_SELECTIVE - 1;
+        max_deliver |= OFFER_SELECTIVE;
+      }
+      transid = transaction_create(selectedpeers[i]->id);
       dprintf("\t sending offer(%d) to %s, cb_size: %d\n", transid, node_addr_tr(selectedpeers[i]->id), selectedpeers[i]->cb_size);
       offerChunks(selectedpeers[i]->id, offer_cset, max_deliver, transid++);
 			if (signal_log) log_signal(get_my_addr(),selectedpeers[i]->id,chunkID_set_size(offer_cset),transid,sig_offer,"SENT");
@@ -870,6 +1418,12 @@ void send_chunk()
   neighbours = peerset_get_peers(pset);
   dprintf("Send Chunk: %d neighbours\n", n);
   if (n == 0) return;
+#ifdef NH_EXT
+  if (send_congested()) {	// the chunk would be dropped, skip this tick
+    dprintf("Send Chunk: net helper congested, skipping\n");
+    return;
+  }
+#endif
   buff = cb_get_chunks(cb, &size);
   dprintf("\t %d chunks in buffer...\n", size);
   if (size == 0) return;
@@ -889,12 +1443,28 @@ void send_chunk()
   
     for (i = 0;i < size; i++) chunkids[size - 1 - i] = (buff+i)->id;
     for (i = 0; i<n; i++) nodeids[i] = neighbours[i];
+    if (edf_scheduling) {
+      selectedpairs_len = edf_select_push(nodeids, n, selectedpairs);
+    } else {
+#if SCHED_MATRIX
+      struct peer *target[1];
+
+      // only the latest chunk is pushed: a one-column matrix
+      sched_matrix_build(nodeids, n, chunkids, 1, chunk_fresh);
+      sched_matrix_select_peers(SCHED_WEIGHTING, nodeids, chunkids, 1, target, &selectedpairs_len, push_strategy ? peerWeightLoss : SCHED_PEER);
+      if (selectedpairs_len) {
+        selectedpairs[0].peer = target[0];
+        selectedpairs[0].chunk = chunkids[0];
+      }
+#else
 		if (push_strategy){
 	    SCHED_TYPE(SCHED_WEIGHTING, nodeids, n, chunkids, 1, selectedpairs, &selectedpairs_len, SCHED_NEEDS, peerWeightLoss, SCHED_CHUNK);
 //			fprintf(stderr,"[DEBUG] using push strategy.\n");
 		}
 		else
 	    SCHED_TYPE(SCHED_WEIGHTING, nodeids, n, chunkids, 1, selectedpairs, &selectedpairs_len, SCHED_NEEDS, SCHED_PEER, SCHED_CHUNK);
+#endif
+    }
   /************ /USE SCHEDULER ****************/
 
     for (i=0; i<selectedpairs_len ; i++){
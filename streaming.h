@@ -32,13 +32,17 @@ struct chunk;
 void stream_init(int size, struct nodeID *myID);
 int source_init(const char *fname, struct nodeID *myID, int *fds, int fds_size, int buff_size);
 void received_chunk(struct nodeID *from, const uint8_t *buff, int len);
+int chunk_decode(const uint8_t *buff, int len, struct chunk *c, uint16_t *transid);
+void chunk_received(struct nodeID *from, struct chunk *c, uint16_t transid);
 void send_chunk();
 struct chunk *generated_chunk(suseconds_t *delta);
 int add_chunk(struct chunk *c);
 struct chunkID_set *get_chunks_to_accept(const struct nodeID *fromid, const struct chunkID_set *cset_off, int max_deliver, uint16_t trans_id);
 void send_offer();
 void send_accepted_chunks(const struct nodeID *to, struct chunkID_set *cset_acc, int max_deliver, uint16_t trans_id);
+void send_requested_chunks(const struct nodeID *to, const struct chunkID_set *cset_req, int max_deliver, uint16_t trans_id);
 void send_bmap(const struct nodeID *to);
+const struct chunkID_set *cb_bmap_snapshot(void);
 
 void log_chunk_error(const struct nodeID *from,const struct nodeID *to,const struct chunk *c,int error);
 void log_chunk(const struct nodeID *from,const struct nodeID *to,const struct chunk *c,const char *note);
@@ -0,0 +1,87 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+#include<string.h>
+#include<stdint.h>
+
+#include"chunk_pool.h"
+
+void chunk_pool_reuse_test()
+{
+	uint8_t * a, * b;
+	uint64_t hits, misses;
+
+	chunk_pool_init(0);
+
+	a = chunk_pool_alloc(1000);
+	assert(a);
+	memset(a,0xAB,1024);	/* the whole class size is usable */
+	chunk_pool_stats(&hits,&misses);
+	assert(hits == 0 && misses == 1);
+
+	chunk_pool_free(a,1000);
+	b = chunk_pool_alloc(970);	/* same class: (960, 1024] */
+	assert(b == a);
+	chunk_pool_stats(&hits,&misses);
+	assert(hits == 1 && misses == 1);
+
+	chunk_pool_free(b,970);
+	b = chunk_pool_alloc(900);	/* finer classes: not rounded up to 1024 */
+	assert(b != a);
+	chunk_pool_free(b,900);
+	b = chunk_pool_alloc(12);
+	assert(b != a);
+	chunk_pool_free(b,12);
+
+	chunk_pool_destroy();
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void chunk_pool_idle_test()
+{
+	void * p[3];
+	uint64_t hits, misses;
+	int i;
+
+	chunk_pool_init(150);
+	for (i = 0; i < 3; i++)
+		p[i] = chunk_pool_alloc(64);
+	for (i = 0; i < 3; i++)
+		chunk_pool_free(p[i],64);	/* last one exceeds the idle bytes and is released */
+	for (i = 0; i < 3; i++)
+		p[i] = chunk_pool_alloc(64);
+	chunk_pool_stats(&hits,&misses);
+	assert(hits == 2 && misses == 4);
+	for (i = 0; i < 3; i++)
+		free(p[i]);	/* pooled blocks are plain malloc()ed blocks */
+
+	chunk_pool_free(NULL,64);
+	chunk_pool_destroy();
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void chunk_pool_large_test()
+{
+	void * p;
+	uint64_t hits, misses;
+
+	chunk_pool_init(0);
+	p = chunk_pool_alloc((1 << CHUNK_POOL_MAX_SHIFT) + 1);
+	assert(p);
+	chunk_pool_free(p,(1 << CHUNK_POOL_MAX_SHIFT) + 1);
+	p = chunk_pool_alloc((1 << CHUNK_POOL_MAX_SHIFT) + 1);
+	chunk_pool_stats(&hits,&misses);
+	assert(hits == 0 && misses == 2);
+	chunk_pool_free(p,(1 << CHUNK_POOL_MAX_SHIFT) + 1);
+
+	chunk_pool_destroy();
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(int argc, char ** argv)
+{
+	chunk_pool_reuse_test();
+	chunk_pool_idle_test();
+	chunk_pool_large_test();
+	return 0;
+}
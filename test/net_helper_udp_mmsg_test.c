@@ -0,0 +1,170 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+#include<string.h>
+#include<stdint.h>
+#include<pthread.h>
+
+#include<net_helper.h>
+#include"net_helper_ext.h"
+
+#define TEST_PORT 6666
+#define THREADED_MSGS 200
+
+static struct nodeID * me;
+
+void nodeid_test()
+{
+	struct nodeID * n1, * n2;
+	uint8_t buff[64];
+	char addr[64];
+	int len;
+
+	n1 = create_node("127.0.0.1",TEST_PORT);
+	assert(nodeid_equal(n1,me));
+	assert(nodeid_cmp(n1,me) == 0);
+	assert(node_port(n1) == TEST_PORT);
+	assert(node_addr(n1,addr,64) > 0);
+	assert(strcmp(addr,"127.0.0.1:6666") == 0);
+
+	len = nodeid_dump(buff,n1,64);
+	assert(len > 0);
+	n2 = nodeid_undump(buff,&len);
+	assert(len == (int)strlen(addr) + 1);
+	assert(nodeid_equal(n1,n2));
+	nodeid_free(n2);
+
+	n2 = create_node("127.0.0.1",TEST_PORT + 1);
+	assert(!nodeid_equal(n1,n2));
+	assert(nodeid_cmp(n1,n2) != 0);
+	nodeid_free(n2);
+	nodeid_free(n1);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void batch_test()
+{
+	struct nodeID * remote;
+	struct timeval tout = {1, 0};
+	uint8_t msg[100], buff[100];
+	int i, len;
+
+	for (i = 0; i < 100; i++)
+	{
+		memset(msg,i,sizeof(msg));
+		assert(send_to_peer(me,me,msg,i + 1) == i + 1);
+	}
+	send_flush();
+	for (i = 0; i < 100; i++)
+	{
+		assert(wait4data(me,&tout,NULL) == 1);
+		len = recv_from_peer(me,&remote,buff,sizeof(buff));
+		assert(len == i + 1);
+		assert(buff[0] == i && buff[len - 1] == i);
+		assert(nodeid_equal(remote,me));
+		nodeid_free(remote);
+	}
+
+	tout.tv_sec = 0;
+	tout.tv_usec = 10000;
+	assert(wait4data(me,&tout,NULL) == 0);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void fragment_test()
+{
+	struct nodeID * remote;
+	struct timeval tout = {1, 0};
+	uint8_t * msg, * data, * first;
+	int i, len, size = 150000;
+
+	msg = malloc(size);
+	for (i = 0; i < size; i++)
+		msg[i] = i % 251;
+	assert(send_to_peer(me,me,msg,size) == size);
+	assert(send_to_peer(me,me,msg,10) == 10);
+	send_flush();
+
+	assert(wait4data(me,&tout,NULL) == 1);
+	len = recv_from_peer_nocopy(me,&remote,&data);
+	assert(len == size);
+	assert(memcmp(data,msg,size) == 0);
+	recv_buffer_free(data);
+	nodeid_free(remote);
+
+	len = recv_from_peer_nocopy(me,&remote,&first);
+	assert(len == 10);
+	assert(memcmp(first,msg,10) == 0);
+	recv_buffer_free(first);
+	nodeid_free(remote);
+
+	/* released receive buffers are reused */
+	assert(send_to_peer(me,me,msg,20) == 20);
+	send_flush();
+	assert(wait4data(me,&tout,NULL) == 1);
+	len = recv_from_peer_nocopy(me,&remote,&data);
+	assert(len == 20);
+	assert(memcmp(data,msg,20) == 0);
+	recv_buffer_free(data);
+	nodeid_free(remote);
+
+	free(msg);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+static void * threaded_sender(void * arg)
+{
+	uint8_t msg[4];
+	int i;
+
+	for (i = 0; i < THREADED_MSGS; i++)
+	{
+		memcpy(msg,&i,sizeof(i));
+		assert(send_to_peer(me,me,msg,sizeof(msg)) == sizeof(msg));
+		if (i % 10 == 9)
+			send_flush();	/* less than a batch: only the flush sends it */
+	}
+
+	return NULL;
+}
+
+/* the receiving thread never flushes: what arrives was flushed by the sender */
+void threaded_test()
+{
+	struct nodeID * remote;
+	struct timeval tout;
+	pthread_t sender;
+	uint8_t * data;
+	int i, n, len;
+
+	assert(pthread_create(&sender,NULL,threaded_sender,NULL) == 0);
+	for (i = 0; i < THREADED_MSGS; i++)
+	{
+		tout.tv_sec = 1;
+		tout.tv_usec = 0;
+		assert(wait4data(me,&tout,NULL) == 1);
+		len = recv_from_peer_nocopy(me,&remote,&data);
+		assert(len == sizeof(int));
+		memcpy(&n,data,sizeof(n));
+		assert(n == i);
+		recv_buffer_free(data);
+		nodeid_free(remote);
+	}
+	pthread_join(sender,NULL);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(int argc, char ** argv)
+{
+	me = net_helper_init("127.0.0.1",TEST_PORT,"");
+	assert(me);
+
+	nodeid_test();
+	batch_test();
+	fragment_test();
+	threaded_test();
+	return 0;
+}
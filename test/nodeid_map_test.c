@@ -0,0 +1,104 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+
+#include<net_helper.h>
+#include"nodeid_map.h"
+
+void nodeid_map_new_test()
+{
+	struct nodeid_map * nm;
+
+	nm = nodeid_map_new(0);
+	assert(nm);
+	assert(nodeid_map_size(nm) == 0);
+	nodeid_map_destroy(&nm);
+	assert(nm == NULL);
+
+	nm = nodeid_map_new(3);
+	assert(nodeid_map_size(nm) == 0);
+	nodeid_map_destroy(&nm);
+	assert(nm == NULL);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void nodeid_map_insert_test()
+{
+	struct nodeid_map * nm;
+	struct nodeID * n1, * n2, * n1bis;
+	int a = 1, b = 2;
+
+	n1 = create_node("127.0.0.1",6000);
+	n2 = create_node("127.0.0.1",6001);
+	n1bis = create_node("127.0.0.1",6000);
+
+	assert(nodeid_map_insert(NULL,n1,&a) < 0);
+	assert(nodeid_map_get(NULL,n1) == NULL);
+
+	nm = nodeid_map_new(1);
+	assert(nodeid_map_get(nm,n1) == NULL);
+
+	assert(nodeid_map_insert(nm,n1,&a) == 0);
+	assert(nodeid_map_size(nm) == 1);
+	assert(nodeid_map_get(nm,n1) == &a);
+	assert(nodeid_map_get(nm,n1bis) == &a);
+	assert(nodeid_map_get(nm,n2) == NULL);
+
+	assert(nodeid_map_insert(nm,n2,&b) == 0);
+	assert(nodeid_map_size(nm) == 2);
+	assert(nodeid_map_get(nm,n2) == &b);
+
+	assert(nodeid_map_insert(nm,n1bis,&b) == 0);
+	assert(nodeid_map_size(nm) == 2);
+	assert(nodeid_map_get(nm,n1) == &b);
+
+	nodeid_map_destroy(&nm);
+	nodeid_free(n1);
+	nodeid_free(n2);
+	nodeid_free(n1bis);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void nodeid_map_remove_test()
+{
+	struct nodeid_map * nm;
+	struct nodeID * nodes[100];
+	int values[100];
+	int i;
+
+	nm = nodeid_map_new(2);
+	for (i = 0; i < 100; i++)
+	{
+		nodes[i] = create_node("127.0.0.1",6000 + i);
+		values[i] = i;
+		assert(nodeid_map_insert(nm,nodes[i],&values[i]) == 0);
+	}
+	assert(nodeid_map_size(nm) == 100);
+
+	for (i = 0; i < 100; i++)
+		assert(nodeid_map_get(nm,nodes[i]) == &values[i]);
+
+	for (i = 0; i < 100; i += 2)
+		assert(nodeid_map_remove(nm,nodes[i]) == &values[i]);
+	assert(nodeid_map_size(nm) == 50);
+	assert(nodeid_map_remove(nm,nodes[0]) == NULL);
+
+	for (i = 0; i < 100; i++)
+		assert(nodeid_map_get(nm,nodes[i]) == (i % 2 ? &values[i] : NULL));
+
+	nodeid_map_destroy(&nm);
+	for (i = 0; i < 100; i++)
+		nodeid_free(nodes[i]);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(char ** argc,int argv)
+{
+	nodeid_map_new_test();
+	nodeid_map_insert_test();
+	nodeid_map_remove_test();
+	return 0;
+}
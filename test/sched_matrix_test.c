@@ -0,0 +1,118 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include<chunkidset.h>
+#include<peer.h>
+
+#include"sched_matrix.h"
+
+static struct peer * peer_new(int cb_size)
+{
+	struct peer * p;
+
+	p = calloc(1,sizeof(struct peer));
+	p->bmap = chunkID_set_init("type=bitmap");
+	p->cb_size = cb_size;
+	return p;
+}
+
+static void peer_destroy(struct peer * p)
+{
+	chunkID_set_free(p->bmap);
+	free(p);
+}
+
+static int odd_only(int cid)
+{
+	return cid % 2;
+}
+
+static double weight_index(struct peer **p)
+{
+	return (*p)->cb_size;
+}
+
+void sched_matrix_needs_test()
+{
+	struct peer * peers[3];
+	int chunks[] = {100, 101, 102, 103, 141, 170};
+	int i;
+
+	peers[0] = peer_new(32);	// empty bmap: needs everything
+	peers[1] = peer_new(32);
+	chunkID_set_add_chunk(peers[1]->bmap,150);
+	chunkID_set_add_chunk(peers[1]->bmap,170);
+	peers[2] = peer_new(0);	// does not want chunks
+
+	sched_matrix_build(peers,3,chunks,6,NULL);
+
+	for (i = 0; i < 6; i++)
+		assert(sched_matrix_needs(0,chunks[i]));
+	assert(!sched_matrix_needs(0,99));
+	assert(!sched_matrix_needs(0,104));
+
+	// peer 1 holds 2 chunks of 32, earliest 150: window starts at 120
+	assert(!sched_matrix_needs(1,100));
+	assert(!sched_matrix_needs(1,103));
+	assert(sched_matrix_needs(1,141));
+	assert(!sched_matrix_needs(1,170));	// it has it
+
+	for (i = 0; i < 6; i++)
+		assert(!sched_matrix_needs(2,chunks[i]));
+
+	sched_matrix_build(peers,3,chunks,6,odd_only);
+	assert(!sched_matrix_needs(0,100));
+	assert(sched_matrix_needs(0,101));
+	assert(sched_matrix_needs(1,141));
+	assert(!sched_matrix_needs(1,103));
+
+	for (i = 0; i < 3; i++)
+		peer_destroy(peers[i]);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void sched_matrix_select_test()
+{
+	struct peer * peers[4], * selected[4];
+	int chunks[] = {10, 11, 12};
+	size_t len;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		peers[i] = peer_new(10 + i);
+	chunkID_set_add_chunk(peers[3]->bmap,10);
+	chunkID_set_add_chunk(peers[3]->bmap,11);
+	chunkID_set_add_chunk(peers[3]->bmap,12);
+
+	sched_matrix_build(peers,4,chunks,3,NULL);
+
+	len = 2;
+	sched_matrix_select_peers(SCHED_BEST,peers,chunks,3,selected,&len,weight_index);
+	assert(len == 2);
+	assert(selected[0] == peers[2]);	// peers[3] has it all
+	assert(selected[1] == peers[1]);
+
+	len = 4;
+	sched_matrix_select_peers(SCHED_WEIGHTED,peers,chunks,3,selected,&len,weight_index);
+	assert(len == 3);
+	for (i = 0; i < 3; i++)
+		assert(selected[i] != peers[3]);
+	assert(selected[0] != selected[1] && selected[1] != selected[2] && selected[0] != selected[2]);
+
+	len = 1;
+	sched_matrix_select_peers(SCHED_WEIGHTED,peers,chunks + 2,1,selected,&len,NULL);
+	assert(len == 1 && selected[0] != peers[3]);
+
+	for (i = 0; i < 4; i++)
+		peer_destroy(peers[i]);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(int argc, char ** argv)
+{
+	sched_matrix_needs_test();
+	sched_matrix_select_test();
+	return 0;
+}
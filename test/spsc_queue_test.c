@@ -0,0 +1,98 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+#include<stdint.h>
+#include<pthread.h>
+#include<sched.h>
+
+#include"spsc_queue.h"
+
+#define N_ITEMS 100000
+
+void spsc_queue_init_test()
+{
+	struct spsc_queue * q;
+
+	q = spsc_queue_new(0);
+	assert(q);
+	assert(spsc_queue_length(q) == 0);
+	spsc_queue_destroy(&q);
+	assert(q == NULL);
+
+	assert(spsc_queue_push(NULL,NULL) < 0);
+	assert(spsc_queue_pop(NULL) == NULL);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void spsc_queue_push_pop_test()
+{
+	struct spsc_queue * q;
+	int a[5], i;
+
+	q = spsc_queue_new(3);	// rounded up to 4
+	assert(spsc_queue_pop(q) == NULL);
+
+	for (i = 0; i < 4; i++)
+		assert(spsc_queue_push(q,&a[i]) == 0);
+	assert(spsc_queue_push(q,&a[4]) < 0);
+	assert(spsc_queue_length(q) == 4);
+
+	for (i = 0; i < 4; i++)
+		assert(spsc_queue_pop(q) == &a[i]);
+	assert(spsc_queue_pop(q) == NULL);
+
+	// wrap around
+	for (i = 0; i < 10; i++)
+	{
+		assert(spsc_queue_push(q,&a[i % 5]) == 0);
+		assert(spsc_queue_pop(q) == &a[i % 5]);
+	}
+	assert(spsc_queue_length(q) == 0);
+
+	spsc_queue_destroy(&q);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+static void * producer(void * arg)
+{
+	struct spsc_queue * q = arg;
+	uintptr_t i;
+
+	for (i = 1; i <= N_ITEMS; i++)
+		while (spsc_queue_push(q,(void *) i) < 0)
+			sched_yield();
+	return NULL;
+}
+
+void spsc_queue_threads_test()
+{
+	struct spsc_queue * q;
+	pthread_t th;
+	uintptr_t expected = 1;
+	void * item;
+
+	q = spsc_queue_new(64);
+	pthread_create(&th,NULL,producer,q);
+	while (expected <= N_ITEMS)
+	{
+		item = spsc_queue_pop(q);
+		if (item)
+			assert((uintptr_t) item == expected++);
+		else
+			sched_yield();
+	}
+	pthread_join(th,NULL);
+	assert(spsc_queue_pop(q) == NULL);
+
+	spsc_queue_destroy(&q);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(int argc, char ** argv)
+{
+	spsc_queue_init_test();
+	spsc_queue_push_pop_test();
+	spsc_queue_threads_test();
+	return 0;
+}
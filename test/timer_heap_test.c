@@ -0,0 +1,82 @@
+#include<malloc.h>
+#include<assert.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"timer_heap.h"
+
+void timer_heap_init_test()
+{
+	struct timer_heap * th;
+
+	th = timer_heap_new(0);
+	assert(th);
+	assert(timer_heap_length(th) == 0);
+	timer_heap_destroy(&th);
+	assert(th == NULL);
+
+	th = timer_heap_new(3);
+	timer_heap_destroy(&th);
+	assert(th == NULL);
+
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void timer_heap_push_test()
+{
+	struct timer_heap * th;
+	uint64_t deadline;
+
+	assert(timer_heap_push(NULL,1,1) < 0);
+
+	th = timer_heap_new(1);
+	assert(timer_heap_push(th,1,-1) < 0);
+	assert(timer_heap_peek(th,&deadline) < 0);
+
+	assert(timer_heap_push(th,30,3) == 0);
+	assert(timer_heap_push(th,10,1) == 0);
+	assert(timer_heap_push(th,20,2) == 0);
+	assert(timer_heap_length(th) == 3);
+
+	assert(timer_heap_peek(th,&deadline) == 1);
+	assert(deadline == 10);
+	assert(timer_heap_length(th) == 3);
+
+	timer_heap_destroy(&th);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+void timer_heap_pop_test()
+{
+	struct timer_heap * th;
+	uint64_t deadline, last = 0;
+	int i;
+
+	assert(timer_heap_pop(NULL,&deadline) < 0);
+
+	th = timer_heap_new(0);
+	srand(7);
+	for (i = 0; i < 1000; i++)
+		assert(timer_heap_push(th,rand() % 500,i) == 0);
+	assert(timer_heap_length(th) == 1000);
+
+	for (i = 0; i < 1000; i++)
+	{
+		assert(timer_heap_pop(th,&deadline) >= 0);
+		assert(deadline >= last);
+		last = deadline;
+	}
+	assert(timer_heap_length(th) == 0);
+	assert(timer_heap_pop(th,&deadline) < 0);
+
+	timer_heap_destroy(&th);
+	fprintf(stderr,"%s successfully passed!\n",__func__);
+}
+
+int main(int argc, char ** argv)
+{
+	timer_heap_init_test();
+	timer_heap_push_test();
+	timer_heap_pop_test();
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "timer_heap.h"
+
+struct timer_heap_entry {
+	uint64_t deadline;
+	int id;
+};
+
+struct timer_heap {
+	struct timer_heap_entry *entries;
+	uint32_t size;
+	uint32_t n_elements;
+};
+
+struct timer_heap * timer_heap_new(const uint32_t size)
+{
+	struct timer_heap * th = NULL;
+
+	th = (struct timer_heap *) malloc(sizeof(struct timer_heap));
+	if (th)
+	{
+		th->size = size ? size : TIMER_HEAP_INC_SIZE;
+		th->n_elements = 0;
+		th->entries = (struct timer_heap_entry *) malloc(th->size * sizeof(struct timer_heap_entry));
+		if (th->entries == NULL)
+		{
+			free(th);
+			th = NULL;
+		}
+	}
+	return th;
+}
+
+void timer_heap_destroy(struct timer_heap **th)
+{
+	if (th && *th)
+	{
+		free((*th)->entries);
+		free(*th);
+		*th = NULL;
+	}
+}
+
+uint32_t timer_heap_length(const struct timer_heap *th)
+{
+	return th ? th->n_elements : 0;
+}
+
+int timer_heap_push(struct timer_heap *th, const uint64_t deadline, const int id)
+{
+	struct timer_heap_entry *e;
+	uint32_t i, parent;
+
+	if (th == NULL || id < 0)
+		return -1;
+
+	if (th->n_elements == th->size)
+	{
+		e = (struct timer_heap_entry *) realloc(th->entries, (th->size + TIMER_HEAP_INC_SIZE) * sizeof(struct timer_heap_entry));
+		if (e == NULL)
+			return -1;
+		th->entries = e;
+		th->size += TIMER_HEAP_INC_SIZE;
+	}
+
+	i = th->n_elements++;
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (th->entries[parent].deadline <= deadline)
+			break;
+		th->entries[i] = th->entries[parent];
+		i = parent;
+	}
+	th->entries[i].deadline = deadline;
+	th->entries[i].id = id;
+
+	return 0;
+}
+
+int timer_heap_peek(const struct timer_heap *th, uint64_t *deadline)
+{
+	if (th == NULL || th->n_elements == 0)
+		return -1;
+
+	if (deadline)
+		*deadline = th->entries[0].deadline;
+	return th->entries[0].id;
+}
+
+int timer_heap_pop(struct timer_heap *th, uint64_t *deadline)
+{
+	struct timer_heap_entry last;
+	uint32_t i, child;
+	int id;
+
+	id = timer_heap_peek(th, deadline);
+	if (id < 0)
+		return -1;
+
+	last = th->entries[--th->n_elements];
+	i = 0;
+	while ((child = 2 * i + 1) < th->n_elements)
+	{
+		if (child + 1 < th->n_elements && th->entries[child + 1].deadline < th->entries[child].deadline)
+			child++;
+		if (last.deadline <= th->entries[child].deadline)
+			break;
+		th->entries[i] = th->entries[child];
+		i = child;
+	}
+	th->entries[i] = last;
+
+	return id;
+}
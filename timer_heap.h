@@ -0,0 +1,26 @@
+#ifndef __TIMER_HEAP_H__
+#define __TIMER_HEAP_H__ 1
+
+#include <stdint.h>
+
+#define TIMER_HEAP_INC_SIZE 8
+
+/*
+ * Binary min-heap of (deadline, id) pairs; the id is chosen by the caller.
+ * Ids with equal deadlines come out in no particular order.
+ */
+struct timer_heap * timer_heap_new(const uint32_t size);
+
+void timer_heap_destroy(struct timer_heap **th);
+
+int timer_heap_push(struct timer_heap *th, const uint64_t deadline, const int id);
+
+/* returns the id of the earliest timer without removing it, -1 if empty */
+int timer_heap_peek(const struct timer_heap *th, uint64_t *deadline);
+
+/* removes and returns the id of the earliest timer, -1 if empty */
+int timer_heap_pop(struct timer_heap *th, uint64_t *deadline);
+
+uint32_t timer_heap_length(const struct timer_heap *th);
+
+#endif
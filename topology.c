@@ -38,12 +38,18 @@
 #include "dbg.h"
 #include "measures.h"
 #include "xlweighter.h"
+#include "nodeid_map.h"
 #include "streamer.h"
 #include "node_addr.h"
 
 #define MAX(A,B) (((A) > (B)) ? (A) : (B))
 #define NEIGHBOURHOOD_ADD 0
 #define NEIGHBOURHOOD_REMOVE 1
+#define NEIGHBOURHOOD_FEATURES 2	// one byte of feature flags, older peers drop it as unknown
+#define FEATURE_SELECTIVE_OFFERS 0x01	// understands selective offers, see OFFER_SELECTIVE
+#define FEATURE_QUERY 0x80	// the sender wants our flags back
+#define FEATURES_KNOWN 0x100	// stored with the flags, so that no flags is not NULL
+#define MY_FEATURES FEATURE_SELECTIVE_OFFERS
 #define DEFAULT_PEER_CBSIZE 50
 
 #ifndef NAN	//NAN is missing in some old math.h versions
@@ -79,6 +85,8 @@ struct topology_context{
 	struct peerset * neighbourhood;
 	struct peerset * swarm_bucket;
 	struct peerset * locked_neighs;
+	struct nodeid_map * peer_index; // nodeID -> peer for swarm_bucket and neighbourhood
+	struct nodeid_map * peer_features; // nodeID -> feature flags | FEATURES_KNOWN, for the peers that told us
 	struct timeval tout_bmap;
 	struct XLayerWeighter * xlw;
 } context;
@@ -108,10 +116,17 @@ void update_metadata()
 
 struct peer * topology_get_peer(const struct nodeID * id)
 {
-	struct peer * p = NULL;
+	return nodeid_map_get(context.peer_index,id);
+}
+
+struct peer * topology_swarm_add_peer(struct nodeID * id)
+{
+	struct peer * p;
+
+	peerset_add_peer(context.swarm_bucket,id);
 	p = peerset_get_peer(context.swarm_bucket,id);
-	if(p == NULL)
-		p = peerset_get_peer(context.neighbourhood,id);
+	if (p)
+		nodeid_map_insert(context.peer_index,p->id,p);
 	return p;
 }
 
@@ -127,13 +142,15 @@ int topology_init(struct nodeID *myID,const char *config)
 	context.neighbourhood = peerset_init(0);
 	context.swarm_bucket = peerset_init(0);
   context.locked_neighs = peerset_init(0);
+	context.peer_index = nodeid_map_new(NODEID_MAP_INIT_SIZE);
+	context.peer_features = nodeid_map_new(NODEID_MAP_INIT_SIZE);
 
 	if(xloptimization)
 		context.xlw = xlweighter_new(xloptimization);
 	else
 		context.xlw = NULL;
   //fprintf(stderr,"[DEBUG] done with topology init\n");
-	return context.tc && context.neighbourhood && context.swarm_bucket ? 1 : 0;
+	return context.tc && context.neighbourhood && context.swarm_bucket && context.peer_index && context.peer_features ? 1 : 0;
 }
 
 /*useful during bootstrap*/
@@ -141,7 +158,7 @@ int topology_node_insert(struct nodeID *id)
 {
 	struct metadata m = {0};
 	if (topology_get_peer(id) == NULL)
-		peerset_add_peer(context.swarm_bucket,id);
+		topology_swarm_add_peer(id);
 	return psample_add_peer(context.tc,id,&m,sizeof(m));
 }
 
@@ -163,6 +180,32 @@ void topology_peer_set_metadata(struct  peer *p, const struct metadata *m)
 	}
 }
 
+static void features_send(struct nodeID *id, uint8_t flags)
+{
+	uint8_t msg[3];
+
+	msg[0] = MSG_TYPE_NEIGHBOURHOOD;
+	msg[1] = NEIGHBOURHOOD_FEATURES;
+	msg[2] = flags;
+	send_to_peer(get_my_addr(),id,msg,sizeof(msg));
+}
+
+/* answered whatever the topology mode: a peer that queries is about to send us offers */
+static void features_received(struct nodeID *from, uint8_t flags)
+{
+	if (topology_get_peer(from))
+		nodeid_map_insert(context.peer_features,from,(void *)(uintptr_t)((flags & ~FEATURE_QUERY) | FEATURES_KNOWN));
+	if (flags & FEATURE_QUERY)
+		features_send(from,MY_FEATURES);
+}
+
+bool topology_peer_selective_offers(const struct nodeID *id)
+{
+	uintptr_t flags = (uintptr_t) nodeid_map_get(context.peer_features,id);
+
+	return flags & FEATURE_SELECTIVE_OFFERS;
+}
+
 struct peer * neighbourhood_add_peer(const struct nodeID *id)
 {
 	struct peer * p = NULL;
@@ -176,9 +219,12 @@ struct peer * neighbourhood_add_peer(const struct nodeID *id)
 			peerset_add_peer(context.neighbourhood,id);
 			p = peerset_get_peer(context.neighbourhood,id);
       peerset_push_peer(context.locked_neighs,p);
+			nodeid_map_insert(context.peer_index,p->id,p);
 		}
 		add_measures(p->id);
 		send_bmap(id);
+		if (!nodeid_map_get(context.peer_features,p->id))	// older peers never answer
+			features_send(p->id,MY_FEATURES | FEATURE_QUERY);
 	}
 	return p;
 }
@@ -224,7 +270,9 @@ void topology_message_parse(struct nodeID *from, const uint8_t *buff, int len)
 {
 	switch(buff[0]) {
 		case MSG_TYPE_NEIGHBOURHOOD:
-			if (topo_in)
+			if (len > 2 && buff[1] == NEIGHBOURHOOD_FEATURES)
+				features_received(from,buff[2]);
+			else if (topo_in)
 			{
 				neighbourhood_message_parse(from,buff+1,len);
 				reg_neigh_size(peerset_size(context.neighbourhood));
@@ -256,8 +304,7 @@ void topology_sample_peers()
 		if(p==NULL)
 		{
 			//fprintf(stderr,"[DEBUG] NEW PEER!\n");
-			peerset_add_peer(context.swarm_bucket,sample_nodes[i]);
-			p = topology_get_peer(sample_nodes[i]);
+			p = topology_swarm_add_peer(sample_nodes[i]);
 		}
 		else
 			//fprintf(stderr,"[DEBUG] OLD PEER!\n");
@@ -426,7 +473,8 @@ struct peer *nodeid_to_peer(const struct nodeID *id,int reg)
 	return p;
 }
 
-/* move num peers from pset1 to pset2 after applying the filtering_mask function and following the given criterion */
+/* move num peers from pset1 to pset2 after applying the filtering_mask function and following the given criterion
+ * peer structures are moved, not copied, so peer_index entries remain valid */
 void topology_move_peers(struct peerset * pset1, struct peerset * pset2,int num,enum peer_choice criterion,bool (*filter_mask)(const struct peer *),int (*cmp_peer)(const void* p0, const void* p1)) 
 {
 	struct peer * const * const_peers;
@@ -588,7 +636,11 @@ void topology_update()
 	if(!xloptimization)
   {
     peerset_for_each(context.swarm_bucket,p,i)
+    {
       peerset_pop_peer(context.locked_neighs,p->id);
+      nodeid_map_remove(context.peer_index,p->id);
+      nodeid_map_remove(context.peer_features,p->id);
+    }
     peerset_clear(context.swarm_bucket,0);  // we don't remember past peers
   }
 }
@@ -23,6 +23,7 @@
 #define TOPOLOGY_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define MSG_TYPE_NEIGHBOURHOOD   0x22
 
@@ -32,6 +33,8 @@ struct peer *nodeid_to_peer(const struct nodeID* id, int reg);
 int topology_node_insert(struct nodeID *neighbour);
 int topology_init(struct nodeID *myID, const char *config);
 void topology_message_parse(struct nodeID *from, const uint8_t *buff, int len);
+/* whether the peer told us it understands selective offers */
+bool topology_peer_selective_offers(const struct nodeID *id);
 void peerset_print(const struct peerset * pset,const char * name);
 
 #endif	/* TOPOLOGY_H */